@@ -0,0 +1,12 @@
+#version 330 core
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D gColor; // Fragment colors, 0 where nothing was drawn
+uniform vec3 ambient;
+
+// Base of the light volume pass, the lights are added on top
+void main() {
+	FragColor = vec4(ambient * texture(gColor, TexCoords).rgb, 1.0);
+}
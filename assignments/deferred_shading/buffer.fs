@@ -3,9 +3,21 @@
 in vec2 TexCoords;
 out vec4 FragColor;
 
+// SHOW_POSITION and SHOW_NORMAL, defined by the application, decode the
+// G-buffer instead of showing gBuffer
 uniform sampler2D gBuffer;
 
+#include "../../glsl/gbuffer.glsl"
+
 void main() {
+#if defined(SHOW_POSITION)
+	float depth = gbuffer_depth(TexCoords);
+	vec3 color = depth < 1.0 ? eye_position(TexCoords, depth) : vec3(0.0);
+#elif defined(SHOW_NORMAL)
+	vec3 color = gbuffer_depth(TexCoords) < 1.0 ? eye_normal(TexCoords) :
+		vec3(0.0);
+#else
 	vec3 color = texture(gBuffer, TexCoords).rgb;
+#endif
 	FragColor = vec4(color, 1.0);
 }
@@ -2,8 +2,8 @@
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+#include "../../glsl/camera.glsl"
 
 void main() {
     // note that we read the multiplication from right to left
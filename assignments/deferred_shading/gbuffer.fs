@@ -1,20 +1,18 @@
 #version 330 core
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec4 gColor;
+// Positions come from the depth buffer
+layout (location = 0) out vec2 gNormal; // encode_normal()
+layout (location = 1) out vec4 gColor;
 
-in vec3 FragPos;   // Fragment position (eye space)
 in vec2 TexCoords; // Texture coords
 in mat3 TBN;
 
 uniform sampler2D normalMap;
 
-out vec4 FragColor;
+#include "../../glsl/octahedral.glsl"
+#include "../../glsl/normal_map.glsl"
 
 void main() {
-	gNormal = texture(normalMap, TexCoords).rgb;
-	gNormal = normalize(gNormal * 2.0 - 1.0);
-	gNormal = normalize(TBN * gNormal);
-	gPosition = FragPos;
+	gNormal = encode_normal(normalize(TBN
+			* sample_normal_map(normalMap, TexCoords)));
 	gColor = vec4(1.0);
 }
@@ -5,10 +5,9 @@ layout (location = 2) in vec3 aTangent;  // Tangent vector (obj space)
 layout (location = 3) in vec2 aTexture;  // Texture coords
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
-out vec3 FragPos;   // Fragment position (eye space)
+#include "../../glsl/camera.glsl"
+
 out vec2 TexCoords; // Texture coords
 out mat3 TBN;
 
@@ -20,6 +19,5 @@ void main() {
 	vec3 B = cross(N, T);
 	TBN = mat3(T, B, N);
 	TexCoords = aTexture;
-	FragPos = vec3(view * model * vec4(aPos, 1.0)); // Convert position to eye space
 	gl_Position = projection * view * model * vec4(aPos, 1.0);
 }
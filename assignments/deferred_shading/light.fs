@@ -1,47 +1,42 @@
 #version 330 core
 
-struct Light {
-	vec3 position; // Light position (world space)
-	vec3 ambient;  // Ambient color
-	vec3 diffuse;  // Diffuse color
-	vec3 specular; // Specular color
-};
-
 in vec2 TexCoords;
 out vec4 FragColor;
 
-uniform sampler2D gPosition; // Fragment Positions (eye space)
-uniform sampler2D gNormal;   // Fragment Normals (eye space)
 uniform sampler2D gColor;    // Fragment colors
 
-const int LIGHT_COUNT = 20;
+#include "../../glsl/gbuffer.glsl"
+#include "lights.glsl" // TILE_SIZE and CLUSTERED are defined by the application
+#include "point_light.glsl"
 
-uniform mat4 view;
-uniform Light lights[LIGHT_COUNT];
 uniform float shininess;
+uniform vec3 ambient;
 
 void main() {
-	vec3 FragPos = (texture(gPosition, TexCoords).rgb);
-	vec3 FragNormal = (texture(gNormal, TexCoords).rgb);
+	float depth = gbuffer_depth(TexCoords);
+	// Nothing drawn here
+	if (depth == 1.0) {
+		FragColor = vec4(0.0);
+		return;
+	}
+	vec3 FragPos = eye_position(TexCoords, depth);
+	vec3 FragNormal = eye_normal(TexCoords);
 
 	vec3 color = texture(gColor, TexCoords).rgb;
-
-	vec3 result = vec3(0.0, 0.0, 0.0);
-
-	for (int i=0; i<LIGHT_COUNT; i++) {
-		vec3 ambient = lights[i].ambient * color;
-
-		vec3 lightPos = vec3(view * vec4(lights[i].position, 1.0));
-		vec3 lightDir = normalize(lightPos - FragPos);
-		float diff = max(dot(FragNormal, lightDir), 0.0);
-		vec3 diffuse = diff * lights[i].diffuse * color;
-
-		vec3 viewDir = normalize(-FragPos);
-		vec3 reflectDir = reflect(-lightDir, FragNormal);
-		float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
-		vec3 specular = spec * lights[i].specular;
-
-		result = result + ambient + diffuse + specular;
+	vec3 result = ambient * color;
+
+	uvec2 list = light_list(FragPos);
+#ifdef COUNT_LIGHTS
+	// Benchmark: lights looped over
+	FragColor = vec4(float(list.y), 0.0, 0.0, 1.0);
+	return;
+#endif
+	for (uint i = list.x; i < list.x + list.y; i++) {
+		int l = light_index(i);
+		vec4 light = texelFetch(lights, 2 * l);     // Eye position, radius
+		vec3 lightColor = texelFetch(lights, 2 * l + 1).rgb;
+		result += point_light(FragPos, FragNormal, color, light, lightColor,
+				shininess);
 	}
 	FragColor = vec4(result, 1.0);
 }
@@ -0,0 +1,32 @@
+#version 330 core
+
+flat in vec4 light;      // Eye position, radius
+flat in vec3 lightColor;
+out vec4 FragColor;
+
+uniform sampler2D gColor;    // Fragment colors
+
+#include "../../glsl/gbuffer.glsl"
+#include "point_light.glsl"
+
+uniform float shininess;
+
+// Added to the framebuffer, one light at a time. Only runs where the
+// G-buffer depth is in front of the back of the light's box.
+void main() {
+#ifdef COUNT_LIGHTS
+	// Benchmark: fragments shaded, summed by blending
+	FragColor = vec4(1.0, 0.0, 0.0, 0.0);
+#else
+	vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+	vec3 FragPos = eye_position(uv);
+	vec3 toLight = light.xyz - FragPos;
+	if (dot(toLight, toLight) >= light.w * light.w)
+		discard;
+
+	vec3 FragNormal = eye_normal(uv);
+	vec3 color = texture(gColor, uv).rgb;
+	FragColor = vec4(point_light(FragPos, FragNormal, color, light, lightColor,
+				shininess), 1.0);
+#endif
+}
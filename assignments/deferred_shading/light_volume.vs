@@ -0,0 +1,17 @@
+#version 330 core
+
+layout (location = 0) in vec3 vPosition; // Light cube corner (obj space)
+layout (location = 1) in vec4 vLight;    // Eye position, radius (per light)
+layout (location = 2) in vec4 vColor;    // Light color (per light)
+
+#include "../../glsl/camera.glsl"
+
+flat out vec4 light;
+flat out vec3 lightColor;
+
+void main() {
+	light = vLight;
+	lightColor = vColor.rgb;
+	// The cube is 1 wide, scaled to the box around the light's sphere
+	gl_Position = projection * vec4(vLight.xyz + vPosition * 2.0 * vLight.w, 1.0);
+}
@@ -0,0 +1,29 @@
+// Lights binned in screen tiles of TILE_SIZE pixels (LightTiles) or, with
+// CLUSTERED, in tiles cut in depth slices (LightClusters). Both defined by
+// the application. Texel 2i of `lights` is the eye space position and
+// radius of light i, texel 2i + 1 its color.
+uniform samplerBuffer lights;
+uniform usamplerBuffer tiles;   // First index, number of lights
+uniform usamplerBuffer indices; // Light numbers, tile after tile
+uniform int tilesX;             // Tiles in a row
+#ifdef CLUSTERED
+uniform int tilesY;
+uniform int slices;
+uniform float sliceScale;       // Slice of depth z: log(z) * scale + bias
+uniform float sliceBias;
+#endif
+
+// Lights that can reach this fragment, at `eyePos`
+uvec2 light_list(vec3 eyePos) {
+	ivec2 tile = ivec2(gl_FragCoord.xy) / TILE_SIZE;
+	int entry = tile.y * tilesX + tile.x;
+#ifdef CLUSTERED
+	int slice = int(log(-eyePos.z) * sliceScale + sliceBias);
+	entry += clamp(slice, 0, slices - 1) * tilesX * tilesY;
+#endif
+	return texelFetch(tiles, entry).rg;
+}
+
+int light_index(uint i) {
+	return int(texelFetch(indices, int(i)).r);
+}
@@ -0,0 +1,23 @@
+// Diffuse and specular light on a fragment at fragPos (eye space), from a
+// light at light.xyz (eye space) reaching light.w around it. Fades to 0 at
+// that radius, so lights can be culled beyond it.
+vec3 point_light(vec3 fragPos, vec3 normal, vec3 color, vec4 light,
+		vec3 lightColor, float shininess) {
+	vec3 toLight = light.xyz - fragPos;
+	float d2 = dot(toLight, toLight);
+	float attenuation = clamp(1.0 - d2 / (light.w * light.w), 0.0, 1.0);
+	attenuation *= attenuation;
+	if (attenuation == 0.0)
+		return vec3(0.0);
+
+	vec3 lightDir = toLight * inversesqrt(d2);
+	float diff = max(dot(normal, lightDir), 0.0);
+	vec3 diffuse = diff * lightColor * color;
+
+	vec3 viewDir = normalize(-fragPos);
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+	vec3 specular = spec * lightColor * 0.5;
+
+	return (diffuse + specular) * attenuation;
+}
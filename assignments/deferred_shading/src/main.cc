@@ -7,13 +7,20 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <shader.hh>
+#include <shader_watcher.hh>
 #include <texture.hh>
+#include <gl_ext.hh>
+#include <gl_state.hh>
+#include <light_tiles.hh>
+#include <light_clusters.hh>
+#include <uniform_buffer.hh>
 #include <camera.hh>
 #include <iostream>
 #include <cstddef>
 #include <vector>
 #include <ctime>
 #include <cstdlib>
+#include <cmath>
 #include "cube.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -21,14 +28,31 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void process_input(GLFWwindow *window);
 unsigned int createGBuffer(void);
-void create_lights(void);
+void create_lights(unsigned int count);
 void update_lights(bool restart);
-void draw_lights(const Shader &s);
+void eye_lights(const glm::mat4 &view);
+double bin_lights(LightTiles &tiles, LightClusters &clusters,
+		const glm::mat4 &projection);
+void set_light_uniforms(Shader &shader, const LightClusters &clusters,
+		bool counting);
+unsigned int create_count_buffer(void);
+float average_lights_per_pixel(void);
 void draw_light_cubes(const Shader &cube_shader);
+void draw_light_volumes(unsigned int light_vao);
 
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
-const unsigned int LIGHT_COUNT = 20;
+const unsigned int MIN_LIGHTS = 20;
+const unsigned int MAX_LIGHTS = 20480; // MIN_LIGHTS doubled 10 times
+// Benchmark (B): each count with tiles, clusters then light volumes,
+// BENCH_FRAMES each
+const unsigned int BENCH_COUNTS[] = {20, 50, 100, 200, 500, 1000, 2000, 5000,
+	10000};
+const int BENCH_STEPS = 3 * sizeof(BENCH_COUNTS) / sizeof(BENCH_COUNTS[0]);
+const int BENCH_FRAMES = 100;
+// Of both the tiles and the clusters, so the benchmark only compares the
+// depth slicing
+const int LIGHT_TILE_SIZE = 16;
 Camera camera((float)SCR_WIDTH / SCR_HEIGHT);
 
 struct vec3 {
@@ -51,6 +75,7 @@ struct Light {
 	glm::vec3 position;
 	glm::vec3 axis;
 	float speed;
+	float radius; // Lights nothing further
 };
 
 std::vector<Vertex> obj_data;
@@ -61,6 +86,23 @@ std::vector<Light> lights;
 bool show_lights = true;
 bool pause = false;
 bool pending_light_restart = false;
+unsigned int light_count = MIN_LIGHTS; // Changed with + and -
+bool clustered = false; // Changed with C
+bool volumes = false;   // Changed with V, instead of the full screen loop
+int bench_step = -1;    // -1 when not running
+std::vector<Tile_light> tile_lights;
+
+// Uniform block binding points
+enum {
+	CAMERA_BINDING,
+};
+
+// std140 mirrors of the blocks in the shaders
+struct Camera_block {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 inverse_projection;
+};
 
 float quad_vertices[] = {
 	// Pos       Tex
@@ -113,68 +155,75 @@ void load_obj(const std::string &fname) {
 }
 
 unsigned int gBuffer;
-unsigned int gPosition, gNormal, gColor;
+// 12 bytes per pixel: positions are rebuilt from the depth (gbuffer.glsl),
+// normals are packed in 2 channels
+unsigned int gNormal, gColor, gDepth;
 unsigned int createGBuffer(void) {
 	glGenFramebuffers(1, &gBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+	gl_bind_framebuffer(GL_FRAMEBUFFER, gBuffer);
 
-	// Position buffer
-	glGenTextures(1, &gPosition);
-	glBindTexture(GL_TEXTURE_2D, gPosition);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
-
-	// Normal buffer
+	// Normal buffer, octahedral
 	glGenTextures(1, &gNormal);
-	glBindTexture(GL_TEXTURE_2D, gNormal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
+	gl_bind_texture(GL_TEXTURE_2D, gNormal);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, SCR_WIDTH, SCR_HEIGHT, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gNormal, 0);
 
 	// Color buffer
 	glGenTextures(1, &gColor);
-	glBindTexture(GL_TEXTURE_2D, gColor);
+	gl_bind_texture(GL_TEXTURE_2D, gColor);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gColor, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gColor, 0);
 
 	// tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
-	unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
-	glDrawBuffers(3, attachments);
-
-	// create and attach depth buffer (renderbuffer)
-	unsigned int rboDepth;
-	glGenRenderbuffers(1, &rboDepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+	unsigned int attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(2, attachments);
+
+	// Depth buffer, a texture read by the lighting. Same format as the
+	// default framebuffer's, so it can be blitted there.
+	glGenTextures(1, &gDepth);
+	gl_bind_texture(GL_TEXTURE_2D, gDepth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, gDepth, 0);
 
 	// finally check if framebuffer is complete
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cout << "Framebuffer not complete!" << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
 	return gBuffer;
 }
 
-void create_lights(void) {
+void create_lights(unsigned int count) {
 	Light l;
 	srand(time(NULL));
+	lights.clear();
 	#define randf() ((rand() % 255) / 255.0f)
-	for (unsigned int i=0; i<LIGHT_COUNT; i++) {
-		l.color = glm::normalize(glm::vec3(randf(), randf(), randf())) * ((rand() % 100) / 300.0f);
-		glm::vec3 axis(randf(), randf(), randf());
-		axis = glm::normalize(axis);
+	// Many lights overlap, keep the sum about as bright as with a few
+	float intensity = sqrtf((float)MIN_LIGHTS / count);
+	for (unsigned int i=0; i<count; i++) {
+		l.color = glm::normalize(glm::vec3(randf(), randf(), randf())) *
+			((rand() % 100) / 100.0f) * intensity;
+		glm::vec3 axis(randf() - 0.5f, randf() - 0.5f, randf() - 0.5f);
+		axis = glm::normalize(axis + glm::vec3(0.0f, 0.0f, 0.001f));
 		l.axis = axis;
-		glm::vec3 tmp = axis * (4 + 2 * (rand() % 100) / 100.0f); // Distance in [6, 10] from (0, 0)
-		l.position = glm::cross(tmp, glm::vec3(1.0f, 0.0f, 0.0f));
+		// Orbit at [2.2, 3.5] from (0, 0), just above the ball (radius 2.1)
+		glm::vec3 side = fabsf(axis.x) < 0.9f ? glm::vec3(1, 0, 0) :
+			glm::vec3(0, 1, 0);
+		l.position = glm::normalize(glm::cross(axis, side)) *
+			(2.2f + 1.3f * randf());
 		l.speed = glm::radians(20.0f + rand() % 50);
+		l.radius = 1.0f + randf();
 		lights.push_back(l);
 	}
+	std::cout << count << " lights" << std::endl;
 }
 
 void update_lights(bool restart = false) {
@@ -185,7 +234,7 @@ void update_lights(bool restart = false) {
 	float delta_time = current_time - last_time;
 	last_time = current_time;
 
-	for (int i = 0; i<LIGHT_COUNT; i++) {
+	for (unsigned int i = 0; i<lights.size(); i++) {
 		Light &l = lights[i];
 		l.position = glm::vec3(
 				glm::rotate(glm::mat4(1.0f), delta_time * l.speed, l.axis) *
@@ -193,33 +242,124 @@ void update_lights(bool restart = false) {
 	}
 }
 
-void draw_lights(const Shader &s) {
-	for (int i = 0; i<LIGHT_COUNT; i++) {
+// Lights in eye space, as binned and drawn
+void eye_lights(const glm::mat4 &view) {
+	tile_lights.resize(lights.size());
+	for (unsigned int i = 0; i<lights.size(); i++) {
 		Light &l = lights[i];
-		glm::vec3 light_pos = l.position;
-		glm::vec3 light_color = l.color;
-		glm::vec3 diffuse_color = light_color * glm::vec3(0.7f); // decrease influence
-		glm::vec3 ambient_color = light_color * glm::vec3(0.1f); // low influence
-		
-		s.setVec("lights[" + std::to_string(i) + "].ambient", ambient_color);
-		s.setVec("lights[" + std::to_string(i) + "].diffuse", diffuse_color);
-		s.setVec("lights[" + std::to_string(i) + "].specular", glm::vec3(0.5f));
-		s.setVec("lights[" + std::to_string(i) + "].position", light_pos);
+		glm::vec3 eye = glm::vec3(view * glm::vec4(l.position, 1.0f));
+		tile_lights[i].position = glm::vec4(eye, l.radius);
+		tile_lights[i].color = glm::vec4(l.color * 0.7f, 0.0f); // decrease influence
+	}
+}
+
+// Bins the eye_lights() in tiles or clusters, sends the lists and binds them
+// to units 3 to 5. Returns the time spent binning in seconds.
+double bin_lights(LightTiles &tiles, LightClusters &clusters,
+		const glm::mat4 &projection) {
+	double start = glfwGetTime();
+	double binning;
+	if (clustered) {
+		clusters.bin(tile_lights, projection);
+		binning = glfwGetTime() - start;
+		clusters.upload(tile_lights);
+		clusters.bind(3);
+	}
+	else {
+		tiles.bin(tile_lights, projection);
+		binning = glfwGetTime() - start;
+		tiles.upload(tile_lights);
+		tiles.bind(3);
 	}
+	return binning;
+}
+
+void set_light_uniforms(Shader &shader, const LightClusters &clusters,
+		bool counting) {
+	if (!counting) {
+		shader.setFloat("shininess"_u, 16.0f);
+		shader.setVec("ambient"_u, glm::vec3(0.05f));
+	}
+	if (clustered) {
+		shader.setFloat("sliceScale"_u, clusters.slice_scale());
+		shader.setFloat("sliceBias"_u, clusters.slice_bias());
+	}
+}
+
+// Target of the COUNT_LIGHTS passes. Its depth is a copy of the G-buffer's
+// for the volumes, which can't test against a texture they read.
+unsigned int countBuffer, countTexture, countDepth;
+unsigned int create_count_buffer(void) {
+	glGenFramebuffers(1, &countBuffer);
+	gl_bind_framebuffer(GL_FRAMEBUFFER, countBuffer);
+	glGenTextures(1, &countTexture);
+	gl_bind_texture(GL_TEXTURE_2D, countTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, countTexture, 0);
+	glGenRenderbuffers(1, &countDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, countDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, countDepth);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Count framebuffer not complete!" << std::endl;
+	gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+	return countBuffer;
+}
+
+// Of the pixels covered by the object (depth < 1), in the count buffer.
+// Waits for the GPU, benchmark only.
+float average_lights_per_pixel(void) {
+	std::vector<float> counts(SCR_WIDTH * SCR_HEIGHT * 4);
+	std::vector<float> depths(SCR_WIDTH * SCR_HEIGHT);
+	gl_bind_framebuffer(GL_READ_FRAMEBUFFER, countBuffer);
+	glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_RGBA, GL_FLOAT, counts.data());
+	gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+	glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_COMPONENT, GL_FLOAT, depths.data());
+	gl_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+	double lights = 0.0, covered = 0.0;
+	for (unsigned int i = 0; i < depths.size(); i++)
+		if (depths[i] < 1.0f) {
+			lights += counts[i * 4];
+			covered++;
+		}
+	return covered > 0.0 ? lights / covered : 0.0f;
 }
 
 void draw_light_cubes(const Shader &cube_shader) {
-	for (int i = 0; i<LIGHT_COUNT; i++) {
+	for (unsigned int i = 0; i<lights.size(); i++) {
 		Light &l = lights[i];
-		cube_shader.setVec("lightColor", glm::normalize(l.color));
+		cube_shader.setVec("lightColor"_u, glm::normalize(l.color));
 		glm::mat4 light_model(1.0f);
 		light_model = glm::translate(light_model, l.position);
 		light_model = glm::scale(light_model, glm::vec3(0.2f));
-		cube_shader.setMat("model", light_model);
+		cube_shader.setMat("model"_u, light_model);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 	}
 }
 
+/**
+ * Every light as a box around its sphere, one instanced draw, added to the
+ * framebuffer. The boxes are tested against the G-buffer depth with
+ * GL_GEQUAL: a box face only passes in front of the surface, which is
+ * always true of its back faces when the surface is inside the box, and
+ * never when the surface is behind the box (or there's none, depth 1).
+ * Faces can't be culled, the cube isn't wound consistently; front faces
+ * only pass for surfaces in front of the whole box, the shader drops those.
+ */
+void draw_light_volumes(unsigned int light_vao) {
+	glDepthFunc(GL_GEQUAL);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	gl_bind_vertex_array(light_vao);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 36, lights.size());
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+}
+
 int main()
 {
 	glfwInit();
@@ -247,11 +387,76 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
+	// Every bind below goes through gl_state, redundant ones can be skipped
+	gl_state_enable(true);
 
 	Shader cube_shader("cube.vs", "cube.fs");
 	Shader obj_shader("gbuffer.vs", "gbuffer.fs");
-	Shader light_shader("light.vs", "light.fs");
+	LightTiles tiles(SCR_WIDTH, SCR_HEIGHT, LIGHT_TILE_SIZE);
+	LightClusters clusters(SCR_WIDTH, SCR_HEIGHT, LIGHT_TILE_SIZE);
+
+	// Light pass permutations, [clustered][counting lights]
+	ShaderBatch light_shaders;
+	Shader *light_shader[2][2];
+	for (int c = 0; c < 2; c++)
+		for (int n = 0; n < 2; n++) {
+			Shader_defines defines = {{"TILE_SIZE",
+				std::to_string(LIGHT_TILE_SIZE)}};
+			if (c)
+				defines.push_back(std::make_pair("CLUSTERED", "1"));
+			if (n)
+				defines.push_back(std::make_pair("COUNT_LIGHTS", "1"));
+			light_shader[c][n] = &light_shaders.add("light.vs", "light.fs",
+					defines);
+			light_shader[c][n]->bindBlock("Camera", CAMERA_BINDING);
+			light_shader[c][n]->onReady([&tiles, &clusters, c, n](Shader &s) {
+				// Counting only reads depths and the lists
+				s.setInt("gDepth", 0);
+				s.setInt("tiles", 4); // Units 3 to 5, see bin_lights()
+				if (!n) {
+					s.setInt("gNormal", 1);
+					s.setInt("gColor", 2);
+					s.setInt("lights", 3);
+					s.setInt("indices", 5);
+				}
+				if (c) {
+					s.setInt("tilesX", clusters.tiles_x());
+					s.setInt("tilesY", clusters.tiles_y());
+					s.setInt("slices", clusters.slices());
+				}
+				else
+					s.setInt("tilesX", tiles.tiles_x());
+			});
+		}
+	// Light volumes, [counting lights], and the ambient pass under them
+	Shader *volume_shader[2];
+	for (int n = 0; n < 2; n++) {
+		volume_shader[n] = &light_shaders.add("light_volume.vs",
+				"light_volume.fs", n ? Shader_defines{{"COUNT_LIGHTS", "1"}} :
+				Shader_defines());
+		volume_shader[n]->bindBlock("Camera", CAMERA_BINDING);
+	}
+	volume_shader[0]->onReady([](Shader &s) {
+		s.setInt("gDepth", 0);
+		s.setInt("gNormal", 1);
+		s.setInt("gColor", 2);
+	});
+	Shader &ambient_shader = light_shaders.add("light.vs", "ambient.fs");
+	ambient_shader.onReady([](Shader &s) { s.setInt("gColor", 2); });
+	// G-buffer views, positions and normals are decoded
 	Shader buffer_shader("buffer.vs", "buffer.fs");
+	Shader position_shader("buffer.vs", "buffer.fs", {{"SHOW_POSITION", "1"}});
+	Shader normal_shader("buffer.vs", "buffer.fs", {{"SHOW_NORMAL", "1"}});
+
+	// Saving a shader file rebuilds the programs using it
+	ShaderWatcher shader_watcher;
+	shader_watcher.watch(cube_shader);
+	shader_watcher.watch(obj_shader);
+	shader_watcher.watch(light_shaders);
+	shader_watcher.watch(buffer_shader);
+	shader_watcher.watch(position_shader);
+	shader_watcher.watch(normal_shader);
 
 	load_obj("golfball.obj");
 
@@ -263,7 +468,7 @@ int main()
 	glGenBuffers(1, &light_vbo);
 	// bind the Vertex Array Object first, then bind and set vertex buffer(s),
 	// and then configure vertex attributes(s).
-	glBindVertexArray(light_vao);
+	gl_bind_vertex_array(light_vao);
 
 	glBindBuffer(GL_ARRAY_BUFFER, light_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
@@ -272,10 +477,25 @@ int main()
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
+	// Light volumes: eye position and radius, color, one per instance
+	unsigned int volume_vbo;
+	glGenBuffers(1, &volume_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, volume_vbo);
+	// Filled every frame in volume mode, the light cubes read instance 0
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Tile_light), NULL, GL_STREAM_DRAW);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Tile_light),
+			(void*)offsetof(Tile_light, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribDivisor(1, 1);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Tile_light),
+			(void*)offsetof(Tile_light, color));
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+
 	// ---- object ----
 	glGenVertexArrays(1, &obj_vao);
 	glGenBuffers(1, &obj_vbo);
-	glBindVertexArray(obj_vao);
+	gl_bind_vertex_array(obj_vao);
 
     glGenBuffers(1, &obj_ebo);
 	glBindBuffer(GL_ARRAY_BUFFER, obj_vbo);
@@ -308,7 +528,7 @@ int main()
 	// ---- quad ----
 	glGenVertexArrays(1, &quad_vao);
 	glGenBuffers(1, &quad_vbo);
-	glBindVertexArray(quad_vao);
+	gl_bind_vertex_array(quad_vao);
 
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
@@ -323,7 +543,8 @@ int main()
 
 	// -------------------
 
-	Texture2D normal_map("golfball.png", 0);
+	Texture2D normal_map("golfball.png", 0, true, GL_REPEAT, GL_REPEAT,
+			TEXTURE_NORMAL);
 	obj_shader.use();
 	obj_shader.setInt("normalMap", 0);
 
@@ -332,18 +553,52 @@ int main()
 	camera.set_default_pos(0, 0, 5.5, 0, -90, 45);
 
 	createGBuffer();
-	light_shader.use();
-	light_shader.setInt("gPosition", 0);
-	light_shader.setInt("gNormal", 1);
-	light_shader.setInt("gColor", 2);
+	create_count_buffer();
+	light_shaders.finish();
+
+	// Rewritten every frame
+	UniformBuffer camera_ubo(sizeof(Camera_block), CAMERA_BINDING);
+	cube_shader.bindBlock("Camera", CAMERA_BINDING);
+	obj_shader.bindBlock("Camera", CAMERA_BINDING);
 
 	buffer_shader.use();
 	buffer_shader.setInt("gBuffer", 0);
-
-	create_lights();
+	position_shader.use();
+	position_shader.setInt("gDepth", 1);
+	position_shader.bindBlock("Camera", CAMERA_BINDING);
+	normal_shader.use();
+	normal_shader.setInt("gNormal", 0);
+	normal_shader.setInt("gDepth", 1);
+
+	create_lights(light_count);
+	double last_report = glfwGetTime();
+	double binning = 0.0;
+	int frames = 0;
+	int bench_frame = 0;
 	while (!glfwWindowShouldClose(window))
 	{
+		shader_watcher.update();
 		process_input(window);
+		if (bench_step == 0 && bench_frame == 0) {
+			// Unthrottled, the frame time counts too
+			glfwSwapInterval(0);
+			std::cout << "Tiles of " << tiles.tile_size() << " pixels, "
+				<< clusters.slices() << " depth slices for the clusters"
+				<< std::endl;
+			std::cout << "lights, lighting, ms per frame binning / total, "
+				"lights per covered pixel" << std::endl;
+		}
+		if (bench_step >= 0 && bench_frame == 0) {
+			light_count = BENCH_COUNTS[bench_step / 3];
+			clustered = bench_step % 3 == 1;
+			volumes = bench_step % 3 == 2;
+			mode = 1;
+			last_report = glfwGetTime();
+			binning = 0.0;
+			frames = 0;
+		}
+		if (light_count != lights.size())
+			create_lights(light_count);
 
 		glClearColor(0, 0, 0, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -351,79 +606,166 @@ int main()
 		update_lights(pause || pending_light_restart);
 		pending_light_restart = false;
 
-		glm::vec3 light_pos = lights[0].position;
-		glm::vec3 light_color = lights[0].color;
-
 		glm::mat4 projection = camera.projection_matrix();
 		glm::mat4 view = camera.view_matrix();
+		Camera_block camera_block = {view, projection, glm::inverse(projection)};
+		camera_ubo.set(camera_block);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+		gl_bind_framebuffer(GL_FRAMEBUFFER, gBuffer);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		obj_shader.use();
 		glm::mat4 obj_model(1.0f);
-		obj_shader.setMat("model", obj_model);
-		obj_shader.setMat("view", view);
-		obj_shader.setMat("projection", projection);
+		obj_shader.setMat("model"_u, obj_model);
 		normal_map.activateAndBind();
-		glBindVertexArray(obj_vao);
+		gl_bind_vertex_array(obj_vao);
 		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		if (mode == 1) {
-			light_shader.use();
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, gPosition);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, gNormal);
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, gColor);
-
-			light_shader.setFloat("shininess", 16.0f);
-			draw_lights(light_shader);
-			light_shader.setMat("view", view);
-			glBindVertexArray(quad_vao);
-			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			gl_active_texture(GL_TEXTURE0);
+			gl_bind_texture(GL_TEXTURE_2D, gDepth);
+			gl_active_texture(GL_TEXTURE1);
+			gl_bind_texture(GL_TEXTURE_2D, gNormal);
+			gl_active_texture(GL_TEXTURE2);
+			gl_bind_texture(GL_TEXTURE_2D, gColor);
+			eye_lights(view);
+			// Last benchmark frame, the same lights counted instead of shaded
+			bool counting = bench_step >= 0 && bench_frame == BENCH_FRAMES - 1;
+
+			if (volumes) {
+				glBindBuffer(GL_ARRAY_BUFFER, volume_vbo);
+				glBufferData(GL_ARRAY_BUFFER, tile_lights.size() * sizeof(Tile_light),
+						tile_lights.data(), GL_STREAM_DRAW);
+
+				ambient_shader.use();
+				ambient_shader.setVec("ambient"_u, glm::vec3(0.05f));
+				gl_bind_vertex_array(quad_vao);
+				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+				// The volumes are tested against the G-buffer depth
+				gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+				gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
+				glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT,
+						GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+				gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+				volume_shader[0]->use();
+				volume_shader[0]->setFloat("shininess"_u, 16.0f);
+				draw_light_volumes(light_vao);
+
+				if (counting) {
+					volume_shader[1]->use();
+					gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+					gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, countBuffer);
+					glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT,
+							GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+					gl_bind_framebuffer(GL_FRAMEBUFFER, countBuffer);
+					glClear(GL_COLOR_BUFFER_BIT);
+					draw_light_volumes(light_vao);
+					gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+				}
+			}
+			else {
+				Shader &shader = *light_shader[clustered][0];
+				shader.use();
+				binning += bin_lights(tiles, clusters, projection);
+				set_light_uniforms(shader, clusters, false);
+				gl_bind_vertex_array(quad_vao);
+				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+				if (counting) {
+					Shader &count_shader = *light_shader[clustered][1];
+					count_shader.use();
+					set_light_uniforms(count_shader, clusters, true);
+					gl_bind_framebuffer(GL_FRAMEBUFFER, countBuffer);
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+					gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+				}
+			}
 
-			if (show_lights) {
+			// One draw per cube, they'd weigh more than the lights
+			if (show_lights && bench_step < 0) {
 				// copy depth buffer (may break... in particular with MSAA)
-				glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
+				gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+				gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
 				glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT,
 						GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
 				cube_shader.use();
-				cube_shader.setMat("view", view);
-				cube_shader.setMat("projection", projection);
-				glBindVertexArray(light_vao);
+				gl_bind_vertex_array(light_vao);
 				draw_light_cubes(cube_shader);
 			}
 		}
 		else {
-			buffer_shader.use();
-			glActiveTexture(GL_TEXTURE0);
+			gl_active_texture(GL_TEXTURE1);
+			gl_bind_texture(GL_TEXTURE_2D, gDepth);
+			gl_active_texture(GL_TEXTURE0);
 			if (mode == 2)
-				glBindTexture(GL_TEXTURE_2D, gPosition);
+				position_shader.use();
 
-			if (mode == 3)
-				glBindTexture(GL_TEXTURE_2D, gNormal);
+			if (mode == 3) {
+				normal_shader.use();
+				gl_bind_texture(GL_TEXTURE_2D, gNormal);
+			}
 
-			if (mode == 4)
-				glBindTexture(GL_TEXTURE_2D, gColor);
+			if (mode == 4) {
+				buffer_shader.use();
+				gl_bind_texture(GL_TEXTURE_2D, gColor);
+			}
 
-			glBindVertexArray(quad_vao);
+			gl_bind_vertex_array(quad_vao);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		}
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		frames++;
+		double now = glfwGetTime();
+		if (bench_step >= 0 && ++bench_frame == BENCH_FRAMES) {
+			std::cout << light_count << ", "
+				<< (volumes ? "volumes" : clustered ? "clusters" : "tiles") << ", "
+				<< binning * 1000.0 / frames << " / "
+				<< (now - last_report) * 1000.0 / frames << ", "
+				<< average_lights_per_pixel() << std::endl;
+			bench_frame = 0;
+			if (++bench_step == BENCH_STEPS) {
+				bench_step = -1;
+				glfwSwapInterval(1);
+			}
+			last_report = now;
+			binning = 0.0;
+			frames = 0;
+		}
+		else if (bench_step < 0 && now - last_report > 2.0 && volumes) {
+			std::cout << lights.size() << " light volumes: "
+				<< frames / (now - last_report) << " fps" << std::endl;
+			last_report = now;
+			frames = 0;
+		}
+		else if (bench_step < 0 && now - last_report > 2.0) {
+			std::cout << lights.size() << " lights, "
+				<< (clustered ? "clustered: " : "tiled: ")
+				<< frames / (now - last_report) << " fps, binning "
+				<< binning * 1000.0 / frames << " ms, "
+				<< (clustered ? clusters.average_per_cluster() :
+					tiles.average_per_tile()) << " lights per list on average, "
+				<< (clustered ? clusters.max_per_cluster() :
+					tiles.max_per_tile()) << " at most" << std::endl;
+			last_report = now;
+			binning = 0.0;
+			frames = 0;
+		}
 	}
 
-	glDeleteVertexArrays(1, &light_vao);
-	glDeleteVertexArrays(1, &obj_vao);
+	gl_delete_vertex_arrays(1, &light_vao);
+	gl_delete_vertex_arrays(1, &obj_vao);
 	glDeleteBuffers(1, &light_vbo);
+	glDeleteBuffers(1, &volume_vbo);
 	glDeleteBuffers(1, &obj_vbo);
 	glfwTerminate();
 	return 0;
@@ -461,6 +803,48 @@ void process_input(GLFWwindow *window)
 	}
 	last_p_state = glfwGetKey(window, GLFW_KEY_P);
 
+	static int last_g_state = GLFW_RELEASE;
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && last_g_state == GLFW_RELEASE) {
+		gl_state_report();
+		gl_state_reset_counters();
+	}
+	last_g_state = glfwGetKey(window, GLFW_KEY_G);
+
+	static int last_c_state = GLFW_RELEASE;
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && last_c_state == GLFW_RELEASE)
+		clustered = ! clustered;
+	last_c_state = glfwGetKey(window, GLFW_KEY_C);
+
+	static int last_v_state = GLFW_RELEASE;
+	if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS && last_v_state == GLFW_RELEASE)
+		volumes = ! volumes;
+	last_v_state = glfwGetKey(window, GLFW_KEY_V);
+
+	static int last_b_state = GLFW_RELEASE;
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && last_b_state == GLFW_RELEASE &&
+			bench_step < 0)
+		bench_step = 0;
+	last_b_state = glfwGetKey(window, GLFW_KEY_B);
+
+	// Twice as many / half the lights
+	static int last_plus_state = GLFW_RELEASE;
+	int plus_state = glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS ||
+		glfwGetKey(window, GLFW_KEY_KP_ADD) == GLFW_PRESS ?
+		GLFW_PRESS : GLFW_RELEASE;
+	if (plus_state == GLFW_PRESS && last_plus_state == GLFW_RELEASE &&
+			light_count < MAX_LIGHTS)
+		light_count *= 2;
+	last_plus_state = plus_state;
+
+	static int last_minus_state = GLFW_RELEASE;
+	int minus_state = glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS ||
+		glfwGetKey(window, GLFW_KEY_KP_SUBTRACT) == GLFW_PRESS ?
+		GLFW_PRESS : GLFW_RELEASE;
+	if (minus_state == GLFW_PRESS && last_minus_state == GLFW_RELEASE &&
+			light_count > MIN_LIGHTS)
+		light_count /= 2;
+	last_minus_state = minus_state;
+
 	if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
 		mode = 1;
 
@@ -8,6 +8,7 @@
 #include <assimp/postprocess.h>
 #include <shader.hh>
 #include <texture.hh>
+#include <gl_ext.hh>
 #include <camera.hh>
 #include <iostream>
 #include <cstddef>
@@ -111,6 +112,7 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
 
 	Shader light_shader("light.vs", "light.fs");
 	Shader obj_shader("golfball.vs", "golfball.fs");
@@ -212,7 +214,8 @@ int main()
 			(void*)offsetof(Vertex, texture));
 	glEnableVertexAttribArray(3);
 
-	Texture2D normal_map("golfball.png", 0);
+	Texture2D normal_map("golfball.png", 0, true, GL_REPEAT, GL_REPEAT,
+			TEXTURE_NORMAL);
 	obj_shader.use();
 	obj_shader.setInt("normalMap", 0);
 
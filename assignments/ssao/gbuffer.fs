@@ -1,18 +1,22 @@
 #version 330 core
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec4 gColor;
+// Positions come from the depth buffer
+layout (location = 0) out vec2 gNormal; // encode_normal()
+layout (location = 1) out vec4 gColor;
 
-in vec3 FragPos;    // Fragment position (eye space)
 in vec3 FragNormal; // Fragment normal (eye space)
 in vec2 TexCoords;  // Texture coords
+flat in vec4 SlotRect;
+flat in int SlotLayer;
 
-uniform sampler2D tex;
+uniform sampler2DArray tex;
 
-out vec4 FragColor;
+#include "../../glsl/octahedral.glsl"
 
 void main() {
-	gNormal = normalize(FragNormal);
-	gPosition = FragPos;
-	gColor = texture(tex, TexCoords);
+	gNormal = encode_normal(normalize(FragNormal));
+	// Wrap inside the slot. The derivatives come from the unwrapped coords,
+	// so the fract() seam doesn't jump to the smallest mip level
+	vec2 uv = SlotRect.xy + fract(TexCoords) * SlotRect.zw;
+	gColor = textureGrad(tex, vec3(uv, SlotLayer),
+			dFdx(TexCoords) * SlotRect.zw, dFdy(TexCoords) * SlotRect.zw);
 }
@@ -2,18 +2,28 @@
 layout (location = 0) in vec3 aPos;      // Vertex Position (obj space)
 layout (location = 1) in vec3 aNormal;   // Vertex normal (obj space)
 layout (location = 2) in vec2 aTexture;  // Texture coords
+layout (location = 3) in uint aMaterial; // Slot in the texture array
+
+// MAX_SLOTS is defined by the application
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
-out vec3 FragPos;    // Fragment position (eye space)
+#include "../../glsl/camera.glsl"
+
+uniform vec4 slotRect[MAX_SLOTS]; // Corner and size of each slot (UV units)
+uniform int slotLayer[MAX_SLOTS];
+
 out vec3 FragNormal; // Fragment normal (eye space)
 out vec2 TexCoords;  // Texture coords
+flat out vec4 SlotRect;
+flat out int SlotLayer;
 
 void main() {
 	TexCoords = aTexture;
-	FragPos = vec3(view * model * vec4(aPos, 1.0)); // Convert position to eye space
+	// Materials past the limit were reported, they get the last slot
+	uint slot = min(aMaterial, uint(MAX_SLOTS - 1));
+	SlotRect = slotRect[slot];
+	SlotLayer = slotLayer[slot];
 	// Transform the normal vector to the eye coords, using the normal matrix
 	FragNormal = mat3(transpose(inverse(view * model))) * aNormal;
 	gl_Position = projection * view * model * vec4(aPos, 1.0);
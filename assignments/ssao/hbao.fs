@@ -0,0 +1,70 @@
+#version 330 core
+
+// Horizon based ambient occlusion. DIRECTIONS and STEPS are defined by the
+// application.
+//
+// From each pixel, DIRECTIONS directions are marched on screen, STEPS
+// depth samples each, out to `radius` in eye space. Along a direction, the
+// occlusion grows every time a sample rises above the highest horizon seen
+// so far, by how much higher it is (sine of its elevation over the tangent
+// plane) and less so for far samples. The directions are turned and the
+// steps jittered per pixel by interleaved gradient noise, left for the blur.
+// With the temporal SSAO, frameOffset moves the noise every frame so the
+// accumulated frames use other directions.
+
+in vec2 TexCoords;
+// Occlusion, then the eye z and encoded normal of the pixel for the blur
+out vec4 FragColor;
+
+const float radius = 0.5;
+const float bias = 0.1; // Sine of the smallest elevation counted
+
+uniform float frameOffset; // 0 for a still noise
+
+#include "../../glsl/gbuffer.glsl"
+
+// Jimenez 2014, well spread values in [0, 1) for neighbor pixels
+float interleaved_gradient_noise(vec2 pixel) {
+	return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+void main() {
+	float depth = gbuffer_depth(TexCoords);
+	// Nothing drawn, not occluded
+	if (depth == 1.0) {
+		FragColor = vec4(1.0, 0.0, 0.0, 0.0);
+		return;
+	}
+	vec3 fragPos = eye_position(TexCoords, depth);
+	vec3 normal = eye_normal(TexCoords);
+
+	// `radius` on screen, in texture coordinates
+	vec2 screenRadius = 0.5 * vec2(projection[0][0], projection[1][1])
+		* radius / -fragPos.z;
+	vec2 pixel = gl_FragCoord.xy + 5.588238 * frameOffset;
+	float noise = interleaved_gradient_noise(pixel);
+	float jitter = interleaved_gradient_noise(pixel.yx + 17.0);
+
+	float occlusion = 0.0;
+	for (int d=0; d<DIRECTIONS; d++) {
+		float angle = (float(d) + noise) * (6.2831853 / DIRECTIONS);
+		vec2 direction = vec2(cos(angle), sin(angle)) * screenRadius;
+		float horizon = bias;
+		for (int s=0; s<STEPS; s++) {
+			vec2 uv = TexCoords + direction * ((float(s) + jitter) / STEPS);
+			vec3 v = eye_position(uv) - fragPos;
+			float distance2 = dot(v, v);
+			// Past the radius, or the pixel itself
+			if (distance2 > radius * radius || distance2 < 1e-6)
+				continue;
+			float elevation = dot(normal, v) * inversesqrt(distance2);
+			if (elevation > horizon) {
+				occlusion += (elevation - horizon)
+					* (1.0 - distance2 / (radius * radius));
+				horizon = elevation;
+			}
+		}
+	}
+	occlusion = 1.0 - occlusion / DIRECTIONS;
+	FragColor = vec4(occlusion, fragPos.z, texture(gNormal, TexCoords).rg);
+}
@@ -1,36 +1,42 @@
 #version 330 core
 
-struct Light {
-	vec3 position; // Light position (world space)
-	vec3 ambient;  // Ambient color
-	vec3 diffuse;  // Diffuse color
-	vec3 specular; // Specular color
-};
+// LIGHT_COUNT, and USE_SSAO to attenuate the ambient light, are defined by
+// the application
 
 in vec2 TexCoords;
 out vec4 FragColor;
 
-uniform sampler2D gPosition; // Fragment Positions (eye space)
-uniform sampler2D gNormal;   // Fragment Normals (eye space)
 uniform sampler2D gColor;    // Fragment colors
+#ifdef USE_SSAO
 uniform sampler2D ssao;      // SSAO ambient light attenuation
+#endif
 
-const int LIGHT_COUNT = 1;
+#include "../../glsl/gbuffer.glsl"
+#include "lights.glsl"
 
-uniform mat4 view;                 // View matrix
-uniform Light lights[LIGHT_COUNT]; // Light sources
-uniform float shininess;           // Material shininess
+uniform float shininess; // Material shininess
 
 void main() {
-	vec3 FragPos = (texture(gPosition, TexCoords).rgb);
-	vec3 FragNormal = (texture(gNormal, TexCoords).rgb);
+	float depth = gbuffer_depth(TexCoords);
+	// Nothing drawn here
+	if (depth == 1.0) {
+		FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+	vec3 FragPos = eye_position(TexCoords, depth);
+	vec3 FragNormal = eye_normal(TexCoords);
 
 	vec3 color = texture(gColor, TexCoords).rgb;
+#ifdef USE_SSAO
+	// The same for every light, read once
+	float ambientOcclusion = texture(ssao, TexCoords).r;
+#else
+	const float ambientOcclusion = 1.0;
+#endif
 
 	vec3 result = vec3(0.0, 0.0, 0.0);
 
 	for (int i=0; i<LIGHT_COUNT; i++) {
-		float ambientOcclusion = texture(ssao, TexCoords).r;
 		vec3 ambient = lights[i].ambient * ambientOcclusion * color;
 
 		vec3 lightPos = vec3(view * vec4(lights[i].position, 1.0));
@@ -0,0 +1,12 @@
+struct Light {
+	vec3 position; // Light position (world space)
+	vec3 ambient;  // Ambient color
+	vec3 diffuse;  // Diffuse color
+	vec3 specular; // Specular color
+};
+
+// Rewritten every frame, the lights move. LIGHT_COUNT is defined by the
+// application.
+layout (std140) uniform Lights {
+	Light lights[LIGHT_COUNT];
+};
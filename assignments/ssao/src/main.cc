@@ -7,14 +7,23 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <shader.hh>
+#include <shader_watcher.hh>
 #include <texture.hh>
+#include <gl_ext.hh>
+#include <gl_state.hh>
+#include <texture_array.hh>
+#include <uniform_buffer.hh>
 #include <camera.hh>
 #include <model.hh>
+#include <render_graph.hh>
 #include <iostream>
 #include <cstddef>
 #include <vector>
 #include <ctime>
 #include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
 #include <random>
 #include "cube.h"
 #include <keyboard.hh>
@@ -22,9 +31,9 @@
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void create_gBuffer(void);
+void create_noise_texture(void);
 void create_lights(void);
-void send_lights_to_shader(const Shader &s);
+void send_lights_to_buffer(UniformBuffer &ubo);
 void draw_light_cubes(const Shader &cube_shader);
 void toggle_capture_cursor(int key);
 void setup_keyboard(Keyboard &k);
@@ -34,6 +43,17 @@ const unsigned int SCR_HEIGHT = 600;
 //const unsigned int SCR_WIDTH = 1280;
 //const unsigned int SCR_HEIGHT = 720;
 const unsigned int LIGHT_COUNT = 20;
+const int SSAO_KERNEL_SIZE = 64; // KERNEL_SIZE in ssao.fs
+const int SSAO_BLUR_RADIUS = 4;  // BLUR_RADIUS in ssao_blur.fs, in texels
+// Temporal SSAO: samples per frame (SAMPLE_COUNT in ssao.fs), and how much
+// of the accumulated history is kept each frame
+const int SSAO_TEMPORAL_SAMPLES = 16;
+const float SSAO_HISTORY_WEIGHT = 0.8f;
+// Horizon based AO: directions and steps per direction (hbao.fs)
+const int HBAO_DIRECTIONS = 4;
+const int HBAO_STEPS = 4;
+const int AO_BENCH_FRAMES = 100;
+const int MAX_TEXTURE_SLOTS = 32; // MAX_SLOTS in gbuffer.vs
 Camera camera((float)SCR_WIDTH / SCR_HEIGHT);
 
 struct Light {
@@ -55,9 +75,42 @@ typedef enum {
 int screen_w = SCR_WIDTH;
 int screen_h = SCR_HEIGHT;
 glm::vec2 noiseScale(SCR_WIDTH / 4.0f, SCR_HEIGHT / 4.0f);
+// The SSAO runs at 1 / ssao_scale of the resolution (1, 2 or 4), then is
+// upsampled by a bilateral filter
+int ssao_scale = 1;
+int ssao_w = SCR_WIDTH;
+int ssao_h = SCR_HEIGHT;
+// Accumulates the SSAO of the frames, cheaper ones with rotated samples
+bool temporal_ssao = false;
+bool ssao_history_valid = false;
+int ssao_history = 0; // History written this frame, the other one is read
+bool use_hbao = false;
+// Frames left in the A/B benchmark of the two AO methods
+int ao_bench_frames = 0;
 GLFWwindow* window;
 View_mode mode = MODE_NORMAL;
 std::vector<Light> lights;
+
+// Uniform block binding points
+enum {
+	CAMERA_BINDING,
+	LIGHTS_BINDING,
+	KERNEL_BINDING,
+};
+
+// std140 mirrors of the blocks in the shaders
+struct Camera_block {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 inverse_projection;
+};
+
+struct Light_block {
+	glm::vec4 position; // vec3 in the shader, padded to 16 bytes
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+};
 bool show_lights = false;
 bool pause = false;
 bool use_ssao = true;
@@ -72,14 +125,14 @@ float lerp (float a, float b, float f) {
 void create_ssao_kernel(void) {
 	std::uniform_real_distribution<float> random_floats(0.0f, 1.0f);
 	std::default_random_engine generator;
-	for (int i=0; i<64; i++) {
+	for (int i=0; i<SSAO_KERNEL_SIZE; i++) {
 		glm::vec3 sample(
 			random_floats(generator) * 2.0f - 1.0f,
 			random_floats(generator) * 2.0f - 1.0f,
 			random_floats(generator));
 		sample  = glm::normalize(sample);
 		sample *= random_floats(generator);
-		float scale = (float)i / 64.0f;
+		float scale = (float)i / SSAO_KERNEL_SIZE;
 		scale  = lerp(0.1f, 1.0f, scale * scale);
 		sample *= scale;
 		ssao_kernel.push_back(sample);
@@ -102,111 +155,25 @@ float quad_vertices[] = {
 	 1, -1,  0,   1, 0, // Bottom Right
 };
 
-unsigned int gBuffer, ssaoBuffer, ssaoBlurBuffer;     // Framebuffers
-unsigned int gPosition, gNormal, gColor, rboDepth;    // gBuffer Textures
-unsigned int noiseTexture, ssaoColor, ssaoColorBlur;  // SSAO Textures
-void create_gBuffer(void) {
-	if (!gBuffer) {
-		glGenFramebuffers(1, &gBuffer);
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-
-	// Delete old textures if rebuilding
-	if (gPosition) {
-		glDeleteTextures(1, &gPosition);
-		glDeleteTextures(1, &gNormal);
-		glDeleteTextures(1, &gColor);
-		glDeleteBuffers(1, &rboDepth);
-	}
-
-	// Position buffer
-	glGenTextures(1, &gPosition);
-	glBindTexture(GL_TEXTURE_2D, gPosition);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, screen_w, screen_h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
-
-	// Normal buffer
-	glGenTextures(1, &gNormal);
-	glBindTexture(GL_TEXTURE_2D, gNormal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, screen_w, screen_h, 0, GL_RGB, GL_FLOAT, NULL);
+// Render targets are in the frame's RenderGraph, sized from the screen
+const Rg_texture g_normal_desc = {GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_NEAREST, 1};
+const Rg_texture g_color_desc = {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST, 1};
+const Rg_texture g_depth_desc = {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL,
+	GL_UNSIGNED_INT_24_8, GL_NEAREST, 1};
+unsigned int noiseTexture;
+void create_noise_texture(void) {
+	glGenTextures(1, &noiseTexture);
+	gl_bind_texture(GL_TEXTURE_2D, noiseTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, 4, 4, 0, GL_RGB, GL_FLOAT, &ssao_noise[0]);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
-
-	// Color buffer
-	glGenTextures(1, &gColor);
-	glBindTexture(GL_TEXTURE_2D, gColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screen_w, screen_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gColor, 0);
-
-	// tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
-	unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
-	glDrawBuffers(3, attachments);
-
-	// create and attach depth buffer (renderbuffer)
-	glGenRenderbuffers(1, &rboDepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, screen_w, screen_h);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
-
-	// finally check if framebuffer is complete
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "gBuffer: Framebuffer not complete!" << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 }
 
-void create_ssao_buffer(void) {
-	// Delete old textures if rebuilding
-	if (!noiseTexture) {
-		// Noise texture
-		glGenTextures(1, &noiseTexture);
-		glBindTexture(GL_TEXTURE_2D, noiseTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, 4, 4, 0, GL_RGB, GL_FLOAT, &ssao_noise[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	}
-
-	// SSAO
-	if (!ssaoBuffer)
-		glGenFramebuffers(1, &ssaoBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, ssaoBuffer);
-
-	if (ssaoColor) {
-		glDeleteTextures(1, &ssaoColor);
-		glDeleteTextures(1, &ssaoColorBlur);
-	}
-	glGenTextures(1, &ssaoColor);
-	glBindTexture(GL_TEXTURE_2D, ssaoColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, screen_w, screen_h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ssaoColor, 0);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "ssaoBuffer: Framebuffer not complete!" << std::endl;
-
-	// SSAO Blur
-	if (!ssaoBlurBuffer)
-		glGenFramebuffers(1, &ssaoBlurBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, ssaoBlurBuffer);
-
-	glGenTextures(1, &ssaoColorBlur);
-	glBindTexture(GL_TEXTURE_2D, ssaoColorBlur);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, screen_w, screen_h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ssaoColorBlur, 0);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "ssaoBlurBuffer: Framebuffer not complete!" << std::endl;
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void bind_texture(unsigned int unit, GLuint texture) {
+	gl_active_texture(GL_TEXTURE0 + unit);
+	gl_bind_texture(GL_TEXTURE_2D, texture);
 }
 
 void create_lights(void) {
@@ -218,29 +185,65 @@ void create_lights(void) {
 	lights.push_back(l);
 }
 
-void send_lights_to_shader(const Shader &s) {
+void send_lights_to_buffer(UniformBuffer &ubo) {
+	std::vector<Light_block> blocks(lights.size());
 	for (int i = 0; i<lights.size(); i++) {
 		Light &l = lights[i];
-		glm::vec3 light_pos = l.position;
 		glm::vec3 light_color = l.color;
 		glm::vec3 diffuse_color = light_color * glm::vec3(0.5f); // decrease influence
 		glm::vec3 ambient_color = light_color * glm::vec3(0.5f); // low influence
-		
-		s.setVec("lights[" + std::to_string(i) + "].ambient", ambient_color);
-		s.setVec("lights[" + std::to_string(i) + "].diffuse", diffuse_color);
-		s.setVec("lights[" + std::to_string(i) + "].specular", glm::vec3(0.2f));
-		s.setVec("lights[" + std::to_string(i) + "].position", light_pos);
+
+		blocks[i].position = glm::vec4(l.position, 1.0f);
+		blocks[i].ambient = glm::vec4(ambient_color, 0.0f);
+		blocks[i].diffuse = glm::vec4(diffuse_color, 0.0f);
+		blocks[i].specular = glm::vec4(glm::vec3(0.2f), 0.0f);
 	}
+	ubo.set(blocks.data(), blocks.size() * sizeof(Light_block));
+}
+
+// Occlusion of the pixels in the bound framebuffer, blocks until it's
+// rendered
+std::vector<float> read_ao(void) {
+	std::vector<float> ao(ssao_w * ssao_h);
+	glReadPixels(0, 0, ssao_w, ssao_h, GL_RED, GL_FLOAT, ao.data());
+	return ao;
+}
+
+// Compares the occlusion of both methods, and writes their difference
+// (x4) to ao_difference.pgm
+void compare_ao(const std::vector<float> &a, const std::vector<float> &b) {
+	std::ofstream out("ao_difference.pgm", std::ios::binary);
+	out << "P5\n" << ssao_w << " " << ssao_h << "\n255\n";
+	double total = 0.0;
+	float largest = 0.0f;
+	// PGM rows go down, GL rows up
+	for (int y = ssao_h - 1; y >= 0; y--)
+		for (int x = 0; x < ssao_w; x++) {
+			float d = fabsf(a[y * ssao_w + x] - b[y * ssao_w + x]);
+			total += d;
+			largest = std::max(largest, d);
+			out.put((char)(unsigned char)std::min(d * 4.0f * 255.0f, 255.0f));
+		}
+	std::cout << "AO difference: mean " << total / a.size() << ", max "
+		<< largest << ", image in ao_difference.pgm" << std::endl;
+}
+
+// Warns when a C++ mirror doesn't match the layout of a block
+void check_block(const Shader &s, const std::string &name, size_t bytes) {
+	GLint size = s.blockSize(name);
+	if (size != (GLint)bytes)
+		std::cout << "Uniform block " << name << " is " << size
+			<< " bytes, expected " << bytes << std::endl;
 }
 
 void draw_light_cubes(const Shader &cube_shader) {
 	for (int i = 0; i<lights.size(); i++) {
 		Light &l = lights[i];
-		cube_shader.setVec("lightColor", glm::normalize(l.color));
+		cube_shader.setVec("lightColor"_u, glm::normalize(l.color));
 		glm::mat4 light_model(1.0f);
 		light_model = glm::translate(light_model, l.position);
 		light_model = glm::scale(light_model, glm::vec3(0.2f));
-		cube_shader.setMat("model", light_model);
+		cube_shader.setMat("model"_u, light_model);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 	}
 }
@@ -267,6 +270,33 @@ void setup_keyboard(Keyboard &k) {
 	k.on_key_down(GLFW_KEY_L, [](int i) { show_lights = !show_lights; });
 	k.on_key_down(GLFW_KEY_P, [](int i) { pause = !pause; });
 	k.on_key_down(GLFW_KEY_B, [](int i) { blur_ssao = !blur_ssao; });
+	k.on_key_down(GLFW_KEY_H, [](int i) {
+		ssao_scale = ssao_scale == 4 ? 1 : ssao_scale * 2;
+		std::cout << "SSAO at 1/" << ssao_scale << " resolution" << std::endl;
+	});
+	k.on_key_down(GLFW_KEY_T, [](int i) {
+		temporal_ssao = !temporal_ssao;
+		std::cout << "Temporal SSAO " << (temporal_ssao ? "on" : "off")
+			<< std::endl;
+	});
+	k.on_key_down(GLFW_KEY_M, [](int i) {
+		use_hbao = !use_hbao;
+		ssao_history_valid = false;
+		std::cout << "Ambient occlusion: " << (use_hbao ? "HBAO" : "SSAO")
+			<< std::endl;
+	});
+	k.on_key_down(GLFW_KEY_N, [](int i) {
+		if (ao_bench_frames)
+			return;
+		mode = MODE_NORMAL;
+		use_ssao = true;
+		ao_bench_frames = AO_BENCH_FRAMES;
+		std::cout << "AO benchmark, hold the camera still" << std::endl;
+	});
+	k.on_key_down(GLFW_KEY_G, [](int i) {
+		gl_state_report();
+		gl_state_reset_counters();
+	});
 	k.on_key_down(GLFW_KEY_0, [](int i) { use_ssao = !use_ssao; });
 	k.on_key_down(GLFW_KEY_1, [](int i) { mode = MODE_NORMAL; });
 	k.on_key_down(GLFW_KEY_2, [](int i) { mode = MODE_POSITION_BUFF; });
@@ -303,6 +333,9 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
+	// Every bind below goes through gl_state, redundant ones can be skipped
+	gl_state_enable(true);
 
 	Keyboard keyboard(window);
 	setup_keyboard(keyboard);
@@ -315,7 +348,7 @@ int main()
 	glGenBuffers(1, &light_vbo);
 	// bind the Vertex Array Object first, then bind and set vertex buffer(s),
 	// and then configure vertex attributes(s).
-	glBindVertexArray(light_vao);
+	gl_bind_vertex_array(light_vao);
 
 	glBindBuffer(GL_ARRAY_BUFFER, light_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
@@ -331,7 +364,7 @@ int main()
 	// ---- quad ----
 	glGenVertexArrays(1, &quad_vao);
 	glGenBuffers(1, &quad_vbo);
-	glBindVertexArray(quad_vao);
+	gl_bind_vertex_array(quad_vao);
 
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
@@ -350,186 +383,475 @@ int main()
 	camera.set_pos(-2.2, 1.5, 15, 0, -90, 45);
 	camera.set_default_pos(-2.2, 1.5, 15, 0, -90, 45);
 
-	Shader cube_shader("cube.vs", "cube.fs");
-	Shader obj_shader("gbuffer.vs", "gbuffer.fs");
-	Shader light_shader("light.vs", "light.fs");
-	Shader buffer_shader("buffer.vs", "buffer.fs");
-	Shader ssao_shader("ssao.vs", "ssao.fs");
-	Shader ssao_blur_shader("ssao_blur.vs", "ssao_blur.fs");
-	Shader ssao_buffer_shader("ssao_buffer_shader.vs", "ssao_buffer_shader.fs");
-	Shader light_no_ssao_shader("light_no_ssao.vs", "light_no_ssao.fs");
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Sizes are compiled in, the loops over lights and samples unroll
+	create_lights();
+	std::string light_count = std::to_string(lights.size());
+	Shader_defines ssao_defines = {{"LIGHT_COUNT", light_count},
+		{"USE_SSAO", "1"}};
+	Shader_defines no_ssao_defines = {{"LIGHT_COUNT", light_count}};
+	Shader_defines kernel_defines = {{"KERNEL_SIZE",
+		std::to_string(SSAO_KERNEL_SIZE)}};
+	Shader_defines blur_defines = {{"BLUR_RADIUS",
+		std::to_string(SSAO_BLUR_RADIUS)}};
+
+	// Every program is submitted before any is waited for, so they compile
+	// together. The light pass shows the colors until its program is ready.
+	double shaders_start = glfwGetTime();
+	ShaderBatch shaders;
+	Shader &buffer_shader = shaders.add("buffer.vs", "buffer.fs");
+	// G-buffer views, positions and normals are decoded
+	Shader &position_buffer_shader = shaders.add("buffer.vs", "buffer.fs",
+			{{"SHOW_POSITION", "1"}});
+	Shader &normal_buffer_shader = shaders.add("buffer.vs", "buffer.fs",
+			{{"SHOW_NORMAL", "1"}});
+	Shader &cube_shader = shaders.add("cube.vs", "cube.fs");
+	Shader &obj_shader = shaders.add("gbuffer.vs", "gbuffer.fs",
+			{{"MAX_SLOTS", std::to_string(MAX_TEXTURE_SLOTS)}});
+	Shader &light_shader = shaders.add("light.vs", "light.fs", ssao_defines);
+	Shader &ssao_shader = shaders.add("ssao.vs", "ssao.fs", kernel_defines);
+	Shader_defines temporal_defines = kernel_defines;
+	temporal_defines.push_back({"SAMPLE_COUNT",
+		std::to_string(SSAO_TEMPORAL_SAMPLES)});
+	temporal_defines.push_back({"TEMPORAL", "1"});
+	Shader &ssao_temporal_shader = shaders.add("ssao.vs", "ssao.fs",
+			temporal_defines);
+	Shader &ssao_accumulate_shader = shaders.add("ssao.vs", "ssao_temporal.fs");
+	Shader &hbao_shader = shaders.add("ssao.vs", "hbao.fs", {
+		{"DIRECTIONS", std::to_string(HBAO_DIRECTIONS)},
+		{"STEPS", std::to_string(HBAO_STEPS)}});
+	Shader &ssao_blur_shader = shaders.add("ssao_blur.vs", "ssao_blur.fs",
+			blur_defines);
+	Shader &ssao_buffer_shader = shaders.add("ssao_buffer_shader.vs",
+			"ssao_buffer_shader.fs");
+	Shader &light_no_ssao_shader = shaders.add("light.vs", "light.fs",
+			no_ssao_defines);
+	// Reduced resolution SSAO, down sampling by 2 and 4
+	Shader *ssao_downsample_shader[2];
+	for (int i = 0; i < 2; i++)
+		ssao_downsample_shader[i] = &shaders.add("ssao.vs",
+				"ssao_downsample.fs", {{"SCALE", std::to_string(2 << i)}});
+	Shader &ssao_upsample_shader = shaders.add("ssao.vs", "ssao_upsample.fs");
+	buffer_shader.finish();
+	light_shader.setFallback(&buffer_shader);
+	light_no_ssao_shader.setFallback(&buffer_shader);
+	bool shaders_ready = false;
+	std::cout << "Shaders: submitted in " << (glfwGetTime() - shaders_start)
+		* 1000.0 << " ms, " << Shader::cache_hits << " from the cache, "
+		<< Shader::cache_misses << " compiled" << std::endl;
+
+	gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 	glClearColor(0, 0, 0, 1.0f);
 
-	Texture2D tex("Palette.jpg", 0);
-	obj_shader.use();
-	obj_shader.setInt("tex", 0);
+	// Every material of the city in one texture array
+	TextureArray textures(1024, 1024, 0);
+	city.load_textures(textures);
+	textures.build();
+	if (textures.size() > MAX_TEXTURE_SLOTS)
+		std::cout << "The city has " << textures.size() << " materials, only "
+			<< MAX_TEXTURE_SLOTS << " fit in the shader's slot tables"
+			<< std::endl;
+	obj_shader.onReady([&textures](Shader &s) {
+		s.setInt("tex", 0);
+		int slots = std::min(textures.size(), MAX_TEXTURE_SLOTS);
+		for (int i = 0; i < slots; i++) {
+			const Texture_slot &slot = textures.slot(i);
+			std::string n = std::to_string(i);
+			s.setVec("slotRect[" + n + "]",
+					glm::vec4(slot.u, slot.v, slot.width, slot.height));
+			s.setInt("slotLayer[" + n + "]", slot.layer);
+		}
+	});
 
-	create_gBuffer();
 	create_ssao_kernel();
-	create_ssao_buffer();
-	ssao_shader.use();
-	ssao_shader.setInt("gPosition", 0);
-	ssao_shader.setInt("gNormal", 1);
-	ssao_shader.setInt("texNoise", 2);
+	create_noise_texture();
+	Shader *ao_shaders[] = {&ssao_shader, &ssao_temporal_shader};
+	for (int i = 0; i < 2; i++)
+		ao_shaders[i]->onReady([](Shader &s) {
+			s.setInt("gDepth", 0);
+			s.setInt("gNormal", 1);
+			s.setInt("texNoise", 2);
+		});
+	hbao_shader.onReady([](Shader &s) {
+		s.setInt("gDepth", 0);
+		s.setInt("gNormal", 1);
+	});
+	ssao_accumulate_shader.onReady([](Shader &s) {
+		s.setInt("ssaoInput", 0);
+		s.setInt("history", 1);
+		s.setInt("gDepth", 2);
+	});
 
-	ssao_blur_shader.use();
-	ssao_blur_shader.setInt("ssaoInput", 0);
+	ssao_blur_shader.onReady([](Shader &s) { s.setInt("ssaoInput", 0); });
 
-	light_shader.use();
-	light_shader.setInt("gPosition", 0);
-	light_shader.setInt("gNormal", 1);
-	light_shader.setInt("gColor", 2);
-	light_shader.setInt("ssao", 3);
+	light_shader.onReady([](Shader &s) {
+		s.setInt("gDepth", 0);
+		s.setInt("gNormal", 1);
+		s.setInt("gColor", 2);
+		s.setInt("ssao", 3);
+	});
+
+	ssao_buffer_shader.onReady([](Shader &s) { s.setInt("ssaoInput", 0); });
+
+	for (int i = 0; i < 2; i++)
+		ssao_downsample_shader[i]->onReady([](Shader &s) {
+			s.setInt("gDepth", 0);
+			s.setInt("gNormal", 1);
+		});
+	ssao_upsample_shader.onReady([](Shader &s) {
+		s.setInt("gDepth", 0);
+		s.setInt("gNormal", 1);
+		s.setInt("ssaoInput", 2);
+		s.setInt("lowDepth", 3);
+		s.setInt("lowNormal", 4);
+	});
 
-	ssao_buffer_shader.use();
-	ssao_buffer_shader.setInt("ssaoInput", 0);
+	light_no_ssao_shader.onReady([](Shader &s) {
+		s.setInt("gDepth", 0);
+		s.setInt("gNormal", 1);
+		s.setInt("gColor", 2);
+	});
 
-	light_no_ssao_shader.use();
-	light_no_ssao_shader.setInt("gPosition", 0);
-	light_no_ssao_shader.setInt("gNormal", 1);
-	light_no_ssao_shader.setInt("gColor", 2);
+	position_buffer_shader.onReady([](Shader &s) { s.setInt("gDepth", 1); });
+	normal_buffer_shader.onReady([](Shader &s) {
+		s.setInt("gNormal", 0);
+		s.setInt("gDepth", 1);
+	});
+
+	// Camera matrices and lights change every frame, the kernel never
+	UniformBuffer camera_ubo(sizeof(Camera_block), CAMERA_BINDING);
+	UniformBuffer light_ubo(lights.size() * sizeof(Light_block),
+			LIGHTS_BINDING);
+	std::vector<glm::vec4> kernel; // vec3 arrays are padded to vec4 in std140
+	for (unsigned int i = 0; i < ssao_kernel.size(); i++)
+		kernel.push_back(glm::vec4(ssao_kernel[i], 0.0f));
+	UniformBuffer kernel_ubo(kernel.size() * sizeof(glm::vec4),
+			KERNEL_BINDING, GL_STATIC_DRAW, kernel.data());
+
+	Shader *camera_shaders[] = {&cube_shader, &obj_shader, &light_shader,
+		&light_no_ssao_shader, &ssao_shader, &position_buffer_shader,
+		&ssao_upsample_shader, &ssao_temporal_shader, &ssao_accumulate_shader,
+		&hbao_shader};
+	for (unsigned int i = 0; i < 10; i++)
+		camera_shaders[i]->bindBlock("Camera", CAMERA_BINDING);
+	light_shader.bindBlock("Lights", LIGHTS_BINDING);
+	light_no_ssao_shader.bindBlock("Lights", LIGHTS_BINDING);
+	ssao_shader.bindBlock("Kernel", KERNEL_BINDING);
+	ssao_temporal_shader.bindBlock("Kernel", KERNEL_BINDING);
+	size_t camera_bytes = camera_ubo.size(), light_bytes = light_ubo.size();
+	size_t kernel_bytes = kernel_ubo.size();
+	obj_shader.onReady([camera_bytes](Shader &s) {
+		check_block(s, "Camera", camera_bytes);
+	});
+	light_shader.onReady([light_bytes](Shader &s) {
+		check_block(s, "Lights", light_bytes);
+	});
+	for (int i = 0; i < 2; i++)
+		ao_shaders[i]->onReady([kernel_bytes](Shader &s) {
+			check_block(s, "Kernel", kernel_bytes);
+		});
+
+	// Saving a shader file rebuilds the programs using it
+	ShaderWatcher shader_watcher;
+	shader_watcher.watch(shaders);
+
+	// For the temporal SSAO
+	unsigned int ssao_frame = 0;
+	glm::mat4 previous_view, previous_projection;
+
+	// A/B benchmark: GPU time of each method (kernel SSAO, then HBAO)
+	unsigned int ao_queries[2];
+	glGenQueries(2, ao_queries);
+	double ao_bench_ms[2] = {0.0, 0.0};
+
+	auto draw_quad = [quad_vao]() {
+		gl_bind_vertex_array(quad_vao);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	};
+
+	// The passes are declared every frame, for the view mode and options of
+	// that frame: those it doesn't show are culled, with their targets
+	RenderGraph graph;
+	typedef RenderGraph::Resource Resource;
 
-	create_lights();
 	while (!glfwWindowShouldClose(window))
 	{
+		shader_watcher.update();
+		if (!shaders_ready && shaders.ready()) {
+			shaders.finish();
+			shaders_ready = true;
+			std::cout << "Shaders: all linked after " << (glfwGetTime()
+				- shaders_start) * 1000.0 << " ms" << std::endl;
+		}
+
 		keyboard.process_input();
 		camera.key_press(window);
 
 		glm::mat4 projection = camera.projection_matrix();
 		glm::mat4 view = camera.view_matrix();
+		Camera_block camera_block = {view, projection,
+			glm::inverse(projection)};
+		camera_ubo.set(camera_block);
+		send_lights_to_buffer(light_ubo);
+
+		graph.resize(screen_w, screen_h);
+		ssao_w = (screen_w + ssao_scale - 1) / ssao_scale;
+		ssao_h = (screen_h + ssao_scale - 1) / ssao_scale;
+		noiseScale = glm::vec2(ssao_w / 4.0f, ssao_h / 4.0f);
+		bool reduced = ssao_scale > 1;
+		// SSAO, with the eye z and normal of each pixel for the blur.
+		// Filtered, the blur reads 2 texels per fetch.
+		Rg_texture ao_desc = {GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_LINEAR, ssao_scale};
 
 		// Geometry pass
-		glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		obj_shader.use();
-		glm::mat4 obj_model(1.0f);
-		obj_model = glm::scale(obj_model, glm::vec3(0.005f));
-		obj_shader.setMat("model", obj_model);
-		obj_shader.setMat("view", view);
-		obj_shader.setMat("projection", projection);
-		tex.activateAndBind();
-		city.draw();
-
-		if (mode == MODE_NORMAL || mode == MODE_SSAO_BUFF || mode == MODE_BLUR_BUFF) {
-			if (use_ssao || mode != MODE_NORMAL) {
-				// Generate SSAO texture
-				glBindFramebuffer(GL_FRAMEBUFFER, ssaoBuffer);
-				glClear(GL_COLOR_BUFFER_BIT);
-				ssao_shader.use();
-				// Send kernel + rotation
-				for (unsigned int i=0; i<ssao_kernel.size(); i++)
-					ssao_shader.setVec("samples[" + std::to_string(i) + "]", ssao_kernel[i]);
-				ssao_shader.setMat("projection", projection);
-				ssao_shader.setInt("gPosition", 0);
-				ssao_shader.setInt("gNormal", 1);
-				ssao_shader.setInt("texNoise", 2);
-				ssao_shader.setVec("noiseScale", noiseScale);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, gPosition);
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, gNormal);
-				glActiveTexture(GL_TEXTURE2);
-				glBindTexture(GL_TEXTURE_2D, noiseTexture);
-				glBindVertexArray(quad_vao);
-				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-			}
+		Resource g_depth = graph.texture("gDepth", g_depth_desc);
+		Resource g_normal = graph.texture("gNormal", g_normal_desc);
+		Resource g_color = graph.texture("gColor", g_color_desc);
+		graph.pass("geometry", {}, {g_normal, g_color, g_depth}, [&]() {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			obj_shader.use();
+			glm::mat4 obj_model(1.0f);
+			obj_model = glm::scale(obj_model, glm::vec3(0.005f));
+			obj_shader.setMat("model"_u, obj_model);
+			textures.activateAndBind();
+			city.draw();
+		});
+
+		// What the AO reads, the G-buffer or its downsampled copy
+		Resource ao_depth = g_depth, ao_normal = g_normal;
+		if (reduced) {
+			// Nearest depth and its normal of every block of pixels
+			ao_depth = graph.texture("SSAO depth", {GL_R32F, GL_RED,
+					GL_FLOAT, GL_NEAREST, ssao_scale});
+			ao_normal = graph.texture("SSAO normal", {GL_RG16, GL_RG,
+					GL_UNSIGNED_SHORT, GL_NEAREST, ssao_scale});
+			graph.pass("SSAO downsample", {g_depth, g_normal},
+					{ao_depth, ao_normal}, [&]() {
+				ssao_downsample_shader[ssao_scale == 4]->use();
+				bind_texture(0, graph.gl_texture(g_depth));
+				bind_texture(1, graph.gl_texture(g_normal));
+				draw_quad();
+			});
+		}
 
-			if (mode == MODE_BLUR_BUFF || (mode == MODE_NORMAL && use_ssao && blur_ssao)) {
-				// Blur SSAO texture to remove noise
-				glBindFramebuffer(GL_FRAMEBUFFER, ssaoBlurBuffer);
-				glClear(GL_COLOR_BUFFER_BIT);
-				ssao_blur_shader.use();
-				ssao_blur_shader.setInt("ssaoInput", 0);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, ssaoColor);
-				glBindVertexArray(quad_vao);
-				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		Resource ssao_color = graph.texture("SSAO", ao_desc);
+		graph.pass("SSAO", {ao_depth, ao_normal}, {ssao_color}, [&]() {
+			// After the use() of its shader
+			auto draw_ao = [&]() {
+				bind_texture(0, graph.gl_texture(ao_depth));
+				bind_texture(1, graph.gl_texture(ao_normal));
+				bind_texture(2, noiseTexture);
+				draw_quad();
+			};
+
+			if (ao_bench_frames) {
+				// Both methods on the same frame, the one in use runs
+				// again below
+				Shader *methods[2] = {&ssao_shader, &hbao_shader};
+				std::vector<float> ao[2];
+				for (int m = 0; m < 2; m++) {
+					methods[m]->use();
+					if (m == 0)
+						methods[m]->setVec("noiseScale"_u, noiseScale);
+					else
+						methods[m]->setFloat("frameOffset"_u, 0.0f);
+					glBeginQuery(GL_TIME_ELAPSED, ao_queries[m]);
+					draw_ao();
+					glEndQuery(GL_TIME_ELAPSED);
+					if (ao_bench_frames == 1)
+						ao[m] = read_ao();
+				}
+				for (int m = 0; m < 2; m++) {
+					GLuint64 ns;
+					glGetQueryObjectui64v(ao_queries[m], GL_QUERY_RESULT, &ns);
+					ao_bench_ms[m] += ns / 1e6;
+				}
+				if (--ao_bench_frames == 0) {
+					std::cout << "AO at " << ssao_w << "x" << ssao_h
+						<< ", average of " << AO_BENCH_FRAMES << " frames: SSAO ("
+						<< SSAO_KERNEL_SIZE << " samples) " << ao_bench_ms[0]
+						/ AO_BENCH_FRAMES << " ms, HBAO (" << HBAO_DIRECTIONS
+						* HBAO_STEPS << " samples) " << ao_bench_ms[1]
+						/ AO_BENCH_FRAMES << " ms" << std::endl;
+					compare_ao(ao[0], ao[1]);
+					ao_bench_ms[0] = ao_bench_ms[1] = 0.0;
+				}
 			}
 
-			if (mode != MODE_NORMAL) {
-				// Render SSAO or SSAO_blur buffer
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
-				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-				ssao_buffer_shader.use();
-				glActiveTexture(GL_TEXTURE0);
-				if (mode == MODE_SSAO_BUFF)
-					glBindTexture(GL_TEXTURE_2D, ssaoColor);
-				else
-					glBindTexture(GL_TEXTURE_2D, ssaoColorBlur);
-				glBindVertexArray(quad_vao);
-				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			// Generate SSAO texture
+			Shader &ao_shader = use_hbao ? hbao_shader :
+				temporal_ssao ? ssao_temporal_shader : ssao_shader;
+			ao_shader.use();
+			// Kernel and projection come from uniform buffers
+			if (use_hbao) {
+				// Other directions and steps every frame when accumulated
+				ao_shader.setFloat("frameOffset"_u, temporal_ssao ?
+						(float)(ssao_frame % 64) : 0.0f);
 			}
 			else {
-				// Light Pass
-				glBindFramebuffer(GL_FRAMEBUFFER, 0);
-				//glClearColor(0, 0, 0, 1.0f);
+				ao_shader.setVec("noiseScale"_u, noiseScale);
+				if (temporal_ssao) {
+					// Another subset of the kernel every frame, and the
+					// noise turned by the golden angle
+					float angle = fmodf(ssao_frame * 2.3999632f, 6.2831853f);
+					ao_shader.setInt("sampleOffset"_u, ssao_frame
+							% (SSAO_KERNEL_SIZE / SSAO_TEMPORAL_SAMPLES));
+					ao_shader.setVec("noiseRotation"_u,
+							glm::vec2(cosf(angle), sinf(angle)));
+				}
+			}
+			if (temporal_ssao)
+				ssao_frame++;
+			draw_ao();
+		});
+
+		// The SSAO before the blur
+		Resource ssao_raw = ssao_color;
+		bool temporal_ran = false;
+		if (temporal_ssao) {
+			// Blend into the history, reprojected from the last frame. The
+			// two histories keep their contents from frame to frame.
+			Resource written = graph.texture("SSAO history 0", ao_desc, true);
+			Resource read = graph.texture("SSAO history 1", ao_desc, true);
+			if (ssao_history)
+				std::swap(written, read);
+			graph.pass("SSAO temporal", {ssao_color, read, ao_depth},
+					{written}, [&, read]() {
+				ssao_accumulate_shader.use();
+				ssao_accumulate_shader.setMat("previousEye"_u,
+						previous_view * glm::inverse(view));
+				ssao_accumulate_shader.setMat("previousProjection"_u,
+						previous_projection);
+				bool valid = ssao_history_valid && !graph.created(read);
+				ssao_accumulate_shader.setFloat("historyWeight"_u,
+						valid ? SSAO_HISTORY_WEIGHT : 0.0f);
+				bind_texture(0, graph.gl_texture(ssao_color));
+				bind_texture(1, graph.gl_texture(read));
+				bind_texture(2, graph.gl_texture(ao_depth));
+				draw_quad();
+				temporal_ran = true;
+			});
+			ssao_raw = written;
+		}
+
+		// Blur SSAO texture to remove noise, along x then y
+		Resource blur_x = graph.texture("SSAO blur x", ao_desc);
+		Resource ssao_blurred = graph.texture("SSAO blur", ao_desc);
+		graph.pass("SSAO blur x", {ssao_raw}, {blur_x}, [&]() {
+			ssao_blur_shader.use();
+			ssao_blur_shader.setVec("direction"_u,
+					glm::vec2(1.0f / graph.width(blur_x), 0.0f));
+			bind_texture(0, graph.gl_texture(ssao_raw));
+			draw_quad();
+		});
+		graph.pass("SSAO blur y", {blur_x}, {ssao_blurred}, [&]() {
+			ssao_blur_shader.use();
+			ssao_blur_shader.setVec("direction"_u,
+					glm::vec2(0.0f, 1.0f / graph.height(blur_x)));
+			bind_texture(0, graph.gl_texture(blur_x));
+			draw_quad();
+		});
+
+		// What the light pass and the blur view read
+		Resource ssao_result = mode == MODE_BLUR_BUFF || blur_ssao ?
+			ssao_blurred : ssao_raw;
+		if (reduced) {
+			// Back to the full resolution, along the G-buffer's edges
+			Resource ssao_full = graph.texture("SSAO upsampled", {GL_RED,
+					GL_RED, GL_FLOAT, GL_NEAREST, 1});
+			Resource low = ssao_result;
+			graph.pass("SSAO upsample", {g_depth, g_normal, low, ao_depth,
+					ao_normal}, {ssao_full}, [&, low]() {
+				ssao_upsample_shader.use();
+				bind_texture(0, graph.gl_texture(g_depth));
+				bind_texture(1, graph.gl_texture(g_normal));
+				bind_texture(2, graph.gl_texture(low));
+				bind_texture(3, graph.gl_texture(ao_depth));
+				bind_texture(4, graph.gl_texture(ao_normal));
+				draw_quad();
+			});
+			ssao_result = ssao_full;
+		}
+
+		std::vector<Resource> screen = {RenderGraph::BACKBUFFER};
+		if (mode == MODE_NORMAL) {
+			// Light Pass
+			std::vector<Resource> inputs = {g_depth, g_normal, g_color};
+			if (use_ssao)
+				inputs.push_back(ssao_result);
+			graph.pass("light", inputs, screen, [&]() {
 				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 				Shader &lshader = use_ssao ? light_shader : light_no_ssao_shader;
-				lshader.use();
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, gPosition);
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, gNormal);
-				glActiveTexture(GL_TEXTURE2);
-				glBindTexture(GL_TEXTURE_2D, gColor);
-				if (use_ssao) {
-					glActiveTexture(GL_TEXTURE3);
-					if (blur_ssao)
-						glBindTexture(GL_TEXTURE_2D, ssaoColorBlur);
-					else
-						glBindTexture(GL_TEXTURE_2D, ssaoColor);
-				}
-				lshader.setFloat("shininess", 8.0f);
-				lshader.setMat("view", view);
-				send_lights_to_shader(lshader);
-				glBindVertexArray(quad_vao);
-				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+				bool lit = lshader.use();
+				bind_texture(0, graph.gl_texture(lit ? g_depth : g_color));
+				bind_texture(1, graph.gl_texture(g_normal));
+				bind_texture(2, graph.gl_texture(g_color));
+				if (use_ssao)
+					bind_texture(3, graph.gl_texture(ssao_result));
+				lshader.setFloat("shininess"_u, 8.0f);
+				draw_quad();
 
 				if (show_lights) {
 					// copy depth buffer (may break... in particular with MSAA)
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-					glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT,
+					gl_bind_framebuffer(GL_READ_FRAMEBUFFER, graph.framebuffer(g_depth));
+					gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
+					glBlitFramebuffer(0, 0, screen_w, screen_h, 0, 0, screen_w, screen_h,
 							GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-					glBindFramebuffer(GL_FRAMEBUFFER, 0);
+					gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
 					cube_shader.use();
-					cube_shader.setMat("view", view);
-					cube_shader.setMat("projection", projection);
-					glBindVertexArray(light_vao);
+					gl_bind_vertex_array(light_vao);
 					draw_light_cubes(cube_shader);
 				}
-			}
+			});
+		}
+		else if (mode == MODE_SSAO_BUFF || mode == MODE_BLUR_BUFF) {
+			// Render SSAO or SSAO_blur buffer
+			Resource shown = mode == MODE_SSAO_BUFF ? ssao_raw : ssao_result;
+			graph.pass("SSAO view", {shown}, screen, [&, shown]() {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				ssao_buffer_shader.use();
+				bind_texture(0, graph.gl_texture(shown));
+				draw_quad();
+			});
 		}
 		else {
 			// Show gBuffer
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-			buffer_shader.use();
-			glActiveTexture(GL_TEXTURE0);
-			if (mode == MODE_POSITION_BUFF)
-				glBindTexture(GL_TEXTURE_2D, gPosition);
-
-			if (mode == MODE_NORMAL_BUFF)
-				glBindTexture(GL_TEXTURE_2D, gNormal);
-
-			if (mode == MODE_COLOR_BUFF)
-				glBindTexture(GL_TEXTURE_2D, gColor);
+			Resource shown = mode == MODE_NORMAL_BUFF ? g_normal : g_color;
+			std::vector<Resource> inputs = {g_depth};
+			if (mode != MODE_POSITION_BUFF)
+				inputs.push_back(shown);
+			graph.pass("G-buffer view", inputs, screen, [&, shown]() {
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				bind_texture(1, graph.gl_texture(g_depth));
+				gl_active_texture(GL_TEXTURE0);
+				if (mode == MODE_POSITION_BUFF)
+					position_buffer_shader.use();
+				else {
+					if (mode == MODE_NORMAL_BUFF)
+						normal_buffer_shader.use();
+					else
+						buffer_shader.use();
+					gl_bind_texture(GL_TEXTURE_2D, graph.gl_texture(shown));
+				}
+				draw_quad();
+			});
+		}
 
-			glBindVertexArray(quad_vao);
-			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		graph.execute();
+		if (temporal_ran) {
+			ssao_history = 1 - ssao_history;
+			previous_view = view;
+			previous_projection = projection;
 		}
+		ssao_history_valid = temporal_ran;
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
-	glDeleteVertexArrays(1, &light_vao);
+	glDeleteQueries(2, ao_queries);
+	gl_delete_vertex_arrays(1, &light_vao);
 	glDeleteBuffers(1, &light_vbo);
 	glfwTerminate();
 	return 0;
@@ -543,11 +865,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	// height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
 	camera.set_aspect_ratio((float)width / height);
-	noiseScale = glm::vec2(width / 4.0f, height / 4.0f);
 	screen_w = width;
 	screen_h = height;
-	create_gBuffer();
-	create_ssao_buffer();
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
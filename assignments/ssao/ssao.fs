@@ -1,29 +1,53 @@
 #version 330 core
 
 in vec2 TexCoords;
-out float FragColor;
+// Occlusion, then the eye z and encoded normal of the pixel for the blur
+out vec4 FragColor;
 
-const int kernelSize = 64;
+// KERNEL_SIZE is defined by the application. With TEMPORAL, only
+// SAMPLE_COUNT of the samples are taken each frame, one in every
+// KERNEL_SIZE / SAMPLE_COUNT starting at sampleOffset, and the noise turns:
+// ssao_temporal.fs accumulates the frames.
+#ifndef SAMPLE_COUNT
+#define SAMPLE_COUNT KERNEL_SIZE
+#endif
 const float radius = 0.5;
 //const float bias = 0.025;
 const float bias = 0.015;
 
-uniform sampler2D gPosition; // Fragment Positions (eye space)
-uniform sampler2D gNormal;   // Fragment Normals (eye space)
 uniform sampler2D texNoise;  // Noise texture
 
-uniform vec3 samples[kernelSize];
-uniform mat4 projection;
+#include "../../glsl/gbuffer.glsl"
+
+// Written once. vec4 because std140 pads vec3 array elements anyway.
+layout (std140) uniform Kernel {
+	vec4 samples[KERNEL_SIZE];
+};
+
 uniform vec2 noiseScale;
+#ifdef TEMPORAL
+uniform int sampleOffset;
+uniform vec2 noiseRotation; // cos, sin of this frame's angle
+#endif
 
 // tile noise over screen (this is the number of tiles on each direction)
 //const vec2 noiseScale = vec2(1280.0 / 4.0, 720.0 / 4.0);
 //const vec2 noiseScale = vec2(800.0 / 4.0, 600.0 / 4.0);
 
 void main() {
-	vec3 fragPos   = texture(gPosition, TexCoords).rgb;
-	vec3 normal    = texture(gNormal, TexCoords).rgb;
+	float depth = gbuffer_depth(TexCoords);
+	// Nothing drawn, not occluded
+	if (depth == 1.0) {
+		FragColor = vec4(1.0, 0.0, 0.0, 0.0);
+		return;
+	}
+	vec3 fragPos   = eye_position(TexCoords, depth);
+	vec3 normal    = eye_normal(TexCoords);
 	vec3 randomVec = texture(texNoise, TexCoords * noiseScale).rgb;
+#ifdef TEMPORAL
+	randomVec.xy = mat2(noiseRotation.x, noiseRotation.y,
+			-noiseRotation.y, noiseRotation.x) * randomVec.xy;
+#endif
 
 	// Create TBN to transform samples to the eye space
 	vec3 tangent   = normalize(randomVec - normal * dot(randomVec, normal));
@@ -33,9 +57,13 @@ void main() {
 	// Use each kernel sample to offset the fragment position and compare
 	// the fragment depth with the sample depth
 	float occlusion = 0.0;
-	for (int i=0; i<kernelSize; i++) {
+	for (int i=0; i<SAMPLE_COUNT; i++) {
 		// get sample position
-		vec3 sample = TBN * samples[i];
+#ifdef TEMPORAL
+		vec3 sample = TBN * samples[i * (KERNEL_SIZE / SAMPLE_COUNT) + sampleOffset].xyz;
+#else
+		vec3 sample = TBN * samples[i].xyz;
+#endif
 		sample = fragPos + sample * radius;
 
 		// Transform the sample to screen space so we can get the position and depth
@@ -44,8 +72,8 @@ void main() {
 		offset.xyz /= offset.w;                // perspective divide
 		offset.xyz  = offset.xyz * 0.5 + 0.5;  // transform to 0.0 - 1.0 range
 
-		// Get the sample depth from the position texture
-		float sampleDepth = texture(gPosition, offset.xy).z;
+		// Get the sample depth from the depth buffer
+		float sampleDepth = eye_z(offset.xy);
 
 		// Prevent contribution from surfaces far behind the test surface
 		float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPos.z - sampleDepth));
@@ -54,6 +82,6 @@ void main() {
 	}
 	// Normalize the occlusion and subtract from 1 so we can directly use it to scale
 	// the ambient lighting
-	occlusion = 1.0 - (occlusion / kernelSize);
-	FragColor = occlusion;
+	occlusion = 1.0 - (occlusion / SAMPLE_COUNT);
+	FragColor = vec4(occlusion, fragPos.z, texture(gNormal, TexCoords).rg);
 }
@@ -1,18 +1,52 @@
 #version 330 core
 
+// One pass of a separable, edge preserving blur, run along x then along y.
+// BLUR_RADIUS is defined by the application.
+//
+// The input holds the occlusion, eye z and encoded normal of each pixel
+// (ssao.fs), and is linearly filtered: texels i and i + 1 are read by one
+// fetch in between, placed so the Gaussian weights of both are kept. The
+// neighbors of another depth or orientation (interpolated, like the
+// occlusion) count less, so the blur stops at the edges.
+
 in vec2 TexCoords;
-out float FragColor;
+out vec4 FragColor;
 
 uniform sampler2D ssaoInput;
+uniform vec2 direction; // One texel along the blurred axis
+
+#include "../../glsl/octahedral.glsl"
+
+const float sigma = (BLUR_RADIUS + 1) * 0.5;
+const float depthTolerance = 0.05; // Of the eye depth
+const float normalPower = 8.0;
+
+float gauss(float x) {
+	return exp(-x * x / (2.0 * sigma * sigma));
+}
 
 void main() {
-	vec2 texelSize = 1.0 / vec2(textureSize(ssaoInput, 0));
-	float result = 0.0;
-	for (int x=-2; x<2; x++) {
-		for (int y=-2; y<2; y++) {
-			vec2 offset = vec2(float(x), float(y)) * texelSize;
-			result += texture(ssaoInput, TexCoords + offset).r;
+	vec4 center = texture(ssaoInput, TexCoords);
+	// Nothing drawn here
+	if (center.g == 0.0) {
+		FragColor = center;
+		return;
+	}
+	vec3 normal = decode_normal(center.ba);
+	float tolerance = depthTolerance * abs(center.g);
+
+	float sum = center.r, weights = 1.0;
+	for (int i=1; i<=BLUR_RADIUS; i+=2) {
+		float w0 = gauss(float(i));
+		float w1 = i < BLUR_RADIUS ? gauss(float(i + 1)) : 0.0;
+		float offset = float(i) + w1 / (w0 + w1);
+		for (int side=-1; side<=1; side+=2) {
+			vec4 s = texture(ssaoInput, TexCoords + direction * offset * float(side));
+			float w = (w0 + w1) * exp(-abs(s.g - center.g) / tolerance)
+				* pow(max(dot(normal, decode_normal(s.ba)), 0.0), normalPower);
+			sum += s.r * w;
+			weights += w;
 		}
 	}
-	FragColor = result / (4.0 * 4.0);
+	FragColor = vec4(sum / weights, center.gba);
 }
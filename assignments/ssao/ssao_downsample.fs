@@ -0,0 +1,31 @@
+#version 330 core
+
+// SCALE is defined by the application: every output texel stands for
+// SCALE x SCALE pixels of the G-buffer. The nearest of them is kept, with
+// its normal, so the SSAO sees real surfaces and not averages of
+// foreground and background.
+
+in vec2 TexCoords;
+layout (location = 0) out float outDepth;  // Same range as gDepth
+layout (location = 1) out vec2 outNormal;  // Still encode_normal()
+
+#include "../../glsl/gbuffer.glsl"
+
+void main() {
+	ivec2 size = textureSize(gDepth, 0);
+	ivec2 first = ivec2(gl_FragCoord.xy) * SCALE;
+	ivec2 nearest = min(first, size - 1);
+	float depth = 1.0;
+	for (int y=0; y<SCALE; y++) {
+		for (int x=0; x<SCALE; x++) {
+			ivec2 p = min(first + ivec2(x, y), size - 1);
+			float d = texelFetch(gDepth, p, 0).r;
+			if (d < depth) {
+				depth = d;
+				nearest = p;
+			}
+		}
+	}
+	outDepth = depth;
+	outNormal = texelFetch(gNormal, nearest, 0).rg;
+}
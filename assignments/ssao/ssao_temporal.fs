@@ -0,0 +1,42 @@
+#version 330 core
+
+// Temporal accumulation of the SSAO: the occlusion of this frame is blended
+// into the one of the last frames, found where the pixel was on screen
+// then. If the depth there doesn't match, the history is of another
+// surface (disoccluded, or moving) and only this frame is kept.
+
+in vec2 TexCoords;
+out vec4 FragColor; // Same layout as the input, becomes the history
+
+uniform sampler2D ssaoInput; // This frame (ssao.fs)
+uniform sampler2D history;   // Output of the last frame
+
+#include "../../glsl/gbuffer.glsl"
+
+uniform mat4 previousEye;        // Eye space to the last frame's
+uniform mat4 previousProjection;
+uniform float historyWeight;     // 0 without a history
+
+const float depthTolerance = 0.02; // Of the eye depth
+
+void main() {
+	vec4 current = texture(ssaoInput, TexCoords);
+	// Nothing drawn here
+	if (current.g == 0.0) {
+		FragColor = current;
+		return;
+	}
+
+	vec4 eye = previousEye * vec4(eye_position(TexCoords), 1.0);
+	vec4 clip = previousProjection * eye;
+	vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+	vec4 past = texture(history, uv);
+
+	float weight = historyWeight;
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))
+			|| abs(past.g - eye.z) > depthTolerance * abs(eye.z))
+		weight = 0.0;
+	// Not mixed at all without a history, it may hold anything
+	float ao = weight > 0.0 ? mix(current.r, past.r, weight) : current.r;
+	FragColor = vec4(ao, current.gba);
+}
@@ -0,0 +1,56 @@
+#version 330 core
+
+// Joint bilateral upsampling of the low resolution SSAO: of the 4 low
+// resolution texels around a pixel, those at another depth or facing
+// another way count less than their bilinear weight, so the occlusion
+// doesn't leak across edges (halos).
+
+in vec2 TexCoords;
+out float FragColor;
+
+uniform sampler2D ssaoInput;  // Low resolution occlusion
+uniform sampler2D lowDepth;   // Its depths and normals (ssao_downsample.fs)
+uniform sampler2D lowNormal;
+
+#include "../../glsl/gbuffer.glsl"
+
+const float depthTolerance = 0.02; // Of the eye depth
+const float normalPower = 8.0;
+
+void main() {
+	float depth = gbuffer_depth(TexCoords);
+	if (depth == 1.0) {
+		FragColor = 1.0;
+		return;
+	}
+	float z = depth_to_eye_z(depth);
+	vec3 normal = eye_normal(TexCoords);
+
+	ivec2 size = textureSize(ssaoInput, 0);
+	vec2 p = TexCoords * vec2(size) - 0.5;
+	ivec2 base = ivec2(floor(p));
+	vec2 f = p - vec2(base);
+
+	float sum = 0.0, weights = 0.0;
+	// Nearest in depth, when every weight vanishes
+	float closest = 1.0, closestDistance = 1e20;
+	for (int i=0; i<4; i++) {
+		ivec2 o = ivec2(i & 1, i >> 1);
+		ivec2 t = clamp(base + o, ivec2(0), size - 1);
+		vec2 b = mix(1.0 - f, f, vec2(o));
+		float ao = texelFetch(ssaoInput, t, 0).r;
+
+		float distance = abs(depth_to_eye_z(texelFetch(lowDepth, t, 0).r) - z);
+		float similar = max(dot(normal,
+					decode_normal(texelFetch(lowNormal, t, 0).rg)), 0.0);
+		float w = b.x * b.y * exp(-distance / (depthTolerance * abs(z)))
+			* pow(similar, normalPower);
+		sum += ao * w;
+		weights += w;
+		if (distance < closestDistance) {
+			closestDistance = distance;
+			closest = ao;
+		}
+	}
+	FragColor = weights > 1e-4 ? sum / weights : closest;
+}
@@ -8,6 +8,9 @@
 #include <assimp/postprocess.h>
 #include <shader.hh>
 #include <texture.hh>
+#include <gl_ext.hh>
+#include <image_loader.hh>
+#include <upload_ring.hh>
 #include <camera.hh>
 #include <iostream>
 #include <cstddef>
@@ -103,6 +106,7 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
 
 	Shader light_shader("light.vs", "light.fs");
 	Shader obj_shader("stones.vs", "stones.fs");
@@ -204,8 +208,13 @@ int main()
 			(void*)offsetof(Vertex, texture));
 	glEnableVertexAttribArray(3);
 
-	Texture2D normal_map("stones_norm.jpg", 0);
-	Texture2D diffuse_map("stones.jpg", 1);
+	// Decode both images in parallel, straight into pixel buffers
+	UploadRing upload_ring;
+	ImageLoader loader(0, &upload_ring);
+	Texture_handle normal_map = loader.load("stones_norm.jpg", 0, true,
+			GL_REPEAT, GL_REPEAT, TEXTURE_NORMAL);
+	Texture_handle diffuse_map = loader.load("stones.jpg", 1);
+	loader.finish();
 	obj_shader.use();
 	obj_shader.setInt("normalMap", 0);
 	obj_shader.setInt("diffuseMap", 1);
@@ -242,8 +251,8 @@ int main()
 		obj_shader.setMat("view", view);
 		obj_shader.setMat("projection", projection);
 		obj_shader.setVec("viewPos", camera.position);
-		normal_map.activateAndBind();
-		diffuse_map.activateAndBind();
+		normal_map->activateAndBind();
+		diffuse_map->activateAndBind();
 		glBindVertexArray(obj_vao);
 		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 
@@ -17,12 +17,12 @@ uniform vec3 viewPos;  // Camera position
 uniform sampler2D normalMap;
 uniform sampler2D diffuseMap;
 
+#include "../../glsl/normal_map.glsl"
+
 out vec4 FragColor;
 
 void main() {
-	vec3 normal = texture(normalMap, TexCoords).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
-	normal = normalize(TBN * normal);
+	vec3 normal = normalize(TBN * sample_normal_map(normalMap, TexCoords));
 
 	vec3 color = texture(diffuseMap, TexCoords).rgb;
 
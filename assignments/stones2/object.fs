@@ -19,13 +19,14 @@ uniform vec3 viewPos;
 uniform sampler2D normalMap;
 uniform sampler2D diffuseMap;
 
+#include "../../glsl/normal_map.glsl"
+
 out vec4 FragColor;
 
 void main() {
 	//vec3 normal = vec3(0.0, 0.0, 1.0);
-	vec3 normal = texture(normalMap, fs_in.TexCoords).rgb;
-	normal = normalize(normal * 2.0 - 1.0);
-	normal = normalize(fs_in.TBN * normal);
+	vec3 normal = normalize(fs_in.TBN
+			* sample_normal_map(normalMap, fs_in.TexCoords));
 
 	vec3 color = vec3(texture(diffuseMap, fs_in.TexCoords));
 	//vec3 color = vec3(texture(normalMap, fs_in.TexCoords));
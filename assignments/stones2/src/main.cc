@@ -5,8 +5,13 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <shader.hh>
 #include <texture.hh>
+#include <gl_ext.hh>
+#include <texture_streamer.hh>
+#include <mesh.hh>
+#include <upload_ring.hh>
 #include <camera.hh>
 #include <iostream>
+#include <cmath>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -47,6 +52,7 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
 
 	Shader light_shader("light.vs", "light.fs");
 	Shader obj_shader("object.vs", "object.fs");
@@ -164,6 +170,18 @@ int main()
 		EXPAND3(pos4), EXPAND3(nm), EXPAND2(uv4), EXPAND3(tangent2), EXPAND3(bitangent2),
 	};
 
+	// World units per UV unit of the quad, for the streamer
+	Mesh quad;
+	for (int i = 0; i < 6; i++) {
+		const float *v = obj_vertices + i * 14;
+		Vertex vertex = {{v[0], v[1], v[2]}, {v[3], v[4], v[5]}, {v[6], v[7]}};
+		quad.vertices.push_back(vertex);
+		quad.indices.push_back(i);
+	}
+	float area, uv;
+	quad.uv_area(area, uv);
+	float uv_scale = uv > 0.0f ? std::sqrt(area / uv) : 1.0f;
+
 	glEnable(GL_DEPTH_TEST);
 
 	unsigned int light_vbo, light_vao, obj_vbo, obj_vao;
@@ -208,8 +226,12 @@ int main()
 	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
 	glEnableVertexAttribArray(4);
 
-	Texture2D normal_map("stones_norm.jpg", 0);
-	Texture2D diffuse_map("stones.jpg", 1);
+	// Streams stones.ktex / stones_norm.ktex when baked with texbake
+	UploadRing upload_ring(4 * 1024 * 1024, 4);
+	TextureStreamer streamer(16 * 1024 * 1024, 64, 1, &upload_ring);
+	Texture_handle normal_map = streamer.load("stones_norm.jpg", 0, true,
+			GL_REPEAT, GL_REPEAT, TEXTURE_NORMAL);
+	Texture_handle diffuse_map = streamer.load("stones.jpg", 1);
 	obj_shader.use();
 	obj_shader.setInt("normalMap", 0);
 	obj_shader.setInt("diffuseMap", 1);
@@ -243,8 +265,15 @@ int main()
 		obj_shader.setMat("view", view);
 		obj_shader.setMat("projection", projection);
 		obj_shader.setVec("viewPos", camera.position);
-		normal_map.activateAndBind();
-		diffuse_map.activateAndBind();
+		int fb_width, fb_height;
+		glfwGetFramebufferSize(window, &fb_width, &fb_height);
+		float pixels_per_unit = projection[1][1] * fb_height / 2.0f;
+		float distance = glm::length(camera.position);
+		streamer.use(normal_map, uv_scale, distance, pixels_per_unit);
+		streamer.use(diffuse_map, uv_scale, distance, pixels_per_unit);
+		streamer.update();
+		normal_map->activateAndBind();
+		diffuse_map->activateAndBind();
 		glBindVertexArray(obj_vao);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 
@@ -0,0 +1,6 @@
+// Shared by every shader, updated once per frame
+layout (std140) uniform Camera {
+	mat4 view;       // View matrix
+	mat4 projection;
+	mat4 inverseProjection; // Clip to eye space, see gbuffer.glsl
+};
@@ -0,0 +1,34 @@
+// Reading the G-buffer: depth, normals (octahedral.glsl) and colors. There's
+// no position target, eye positions are rebuilt from the depth.
+#include "camera.glsl"
+#include "octahedral.glsl"
+
+uniform sampler2D gDepth;  // Depth buffer, 1 where nothing was drawn
+uniform sampler2D gNormal; // Eye space normals, encode_normal()
+
+float gbuffer_depth(vec2 uv) {
+	return texture(gDepth, uv).r;
+}
+
+// Eye position of the point at `uv` on screen and `depth` in the depth buffer
+vec3 eye_position(vec2 uv, float depth) {
+	vec4 p = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return p.xyz / p.w;
+}
+
+vec3 eye_position(vec2 uv) {
+	return eye_position(uv, gbuffer_depth(uv));
+}
+
+// Eye z only, cheaper: inverts the projection's z row
+float depth_to_eye_z(float depth) {
+	return projection[3][2] / (1.0 - depth * 2.0 - projection[2][2]);
+}
+
+float eye_z(vec2 uv) {
+	return depth_to_eye_z(gbuffer_depth(uv));
+}
+
+vec3 eye_normal(vec2 uv) {
+	return decode_normal(texture(gNormal, uv).rg);
+}
@@ -0,0 +1,8 @@
+// Tangent space normal of a normal map. The maps may store only X and Y
+// (BC5 has two channels), so Z is always rebuilt, facing out of the surface.
+vec3 sample_normal_map(sampler2D map, vec2 uv) {
+	vec3 n;
+	n.xy = texture(map, uv).rg * 2.0 - 1.0;
+	n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+	return n;
+}
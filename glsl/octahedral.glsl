@@ -0,0 +1,20 @@
+// Unit vectors in 2 numbers: the octahedral mapping folds the sphere onto a
+// square, [0, 1]^2 here so it fits unsigned normalized (RG16) targets.
+// Spreads the precision about evenly over every direction.
+vec2 sign_not_zero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encode_normal(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * sign_not_zero(n.xy);
+	return e * 0.5 + 0.5;
+}
+
+vec3 decode_normal(vec2 e) {
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * sign_not_zero(n.xy);
+	return normalize(n);
+}
@@ -0,0 +1,43 @@
+#ifndef BC_ENCODER_HH
+#define BC_ENCODER_HH
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Block compression encoder (BC1, BC3, BC5 / DXT1, DXT5, RGTC2).
+ *
+ * Images are split in 4x4 blocks, row by row starting at the first row of
+ * pixel data. Blocks on the right / bottom edge of images that are not a
+ * multiple of 4 repeat the last column / row.
+ *
+ * BC1 - RGB, 8 bytes per block (color maps without alpha)
+ * BC3 - RGBA, 16 bytes per block (color maps with alpha)
+ * BC5 - RG, 16 bytes per block (normal maps, Z is rebuilt in the shader)
+ */
+
+enum Bc_format {
+	BC1,
+	BC3,
+	BC5,
+};
+
+// GL internal format for glCompressedTexImage2D
+unsigned int bc_gl_format(Bc_format fmt);
+size_t bc_block_bytes(Bc_format fmt);
+size_t bc_image_bytes(Bc_format fmt, int width, int height);
+
+// Single blocks. `rgba` is 16 pixels, 4 bytes each, row major
+void bc1_encode_block(const unsigned char *rgba, unsigned char *out);
+void bc3_encode_block(const unsigned char *rgba, unsigned char *out);
+void bc5_encode_block(const unsigned char *rgba, unsigned char *out);
+
+/**
+ * Encodes a whole image with `channels` bytes per pixel, splitting the block
+ * rows over `threads` threads (0 = one per core).
+ */
+void bc_encode(Bc_format fmt, const unsigned char *pixels, int width,
+		int height, int channels, std::vector<unsigned char> &out,
+		unsigned int threads = 0);
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef GL_EXT_HH
+#define GL_EXT_HH
+
+#include <glad/glad.h>
+#include <cstring>
+
+/**
+ * Bits of GL we use when the driver has them, but that are not part of the
+ * GL 3.3 core profile glad was generated for.
+ *
+ * Call gl_ext_load() right after gladLoadGLLoader(). Entry points the driver
+ * lacks stay NULL, and code using them falls back to plain GL 3.3.
+ */
+
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// EXT_texture_sRGB + S3TC
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// GL 4.2 / ARB_texture_storage
+typedef void (APIENTRYP Gl_tex_storage_2d)(GLenum target, GLsizei levels,
+		GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP Gl_tex_storage_3d)(GLenum target, GLsizei levels,
+		GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth);
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+typedef void (APIENTRYP Gl_buffer_storage)(GLenum target, GLsizeiptr size,
+		const void *data, GLbitfield flags);
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH           0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS      0x87FE
+#endif
+
+typedef void (APIENTRYP Gl_get_program_binary)(GLuint program,
+		GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP Gl_program_binary)(GLuint program,
+		GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP Gl_program_parameteri)(GLuint program, GLenum pname,
+		GLint value);
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP Gl_max_shader_compiler_threads)(GLuint count);
+
+struct Gl_ext {
+	bool loaded;
+	Gl_tex_storage_2d TexStorage2D;
+	Gl_tex_storage_3d TexStorage3D;
+	Gl_buffer_storage BufferStorage;
+	// Only set when the driver has at least one binary format
+	Gl_get_program_binary GetProgramBinary;
+	Gl_program_binary ProgramBinary;
+	Gl_program_parameteri ProgramParameteri;
+	// Compiles and links run on driver threads, GL_COMPLETION_STATUS_KHR
+	// tells when they are done without blocking
+	bool parallel_compile;
+	Gl_max_shader_compiler_threads MaxShaderCompilerThreads;
+};
+
+inline Gl_ext &gl_ext(void) {
+	static Gl_ext ext;
+	return ext;
+}
+
+inline bool gl_has_extension(const char *name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (ext && strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+inline bool gl_version_at_least(int major, int minor) {
+	GLint v_major = 0, v_minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &v_major);
+	glGetIntegerv(GL_MINOR_VERSION, &v_minor);
+	return v_major > major || (v_major == major && v_minor >= minor);
+}
+
+inline void gl_ext_load(GLADloadproc load) {
+	Gl_ext &e = gl_ext();
+	e.loaded = true;
+	if (gl_version_at_least(4, 2) || gl_has_extension("GL_ARB_texture_storage")) {
+		e.TexStorage2D = (Gl_tex_storage_2d)load("glTexStorage2D");
+		e.TexStorage3D = (Gl_tex_storage_3d)load("glTexStorage3D");
+	}
+	if (gl_version_at_least(4, 4) || gl_has_extension("GL_ARB_buffer_storage"))
+		e.BufferStorage = (Gl_buffer_storage)load("glBufferStorage");
+	if (gl_version_at_least(4, 1) ||
+			gl_has_extension("GL_ARB_get_program_binary")) {
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats > 0) {
+			e.GetProgramBinary = (Gl_get_program_binary)load("glGetProgramBinary");
+			e.ProgramBinary = (Gl_program_binary)load("glProgramBinary");
+			e.ProgramParameteri = (Gl_program_parameteri)load("glProgramParameteri");
+		}
+	}
+	if (gl_has_extension("GL_KHR_parallel_shader_compile")) {
+		e.parallel_compile = true;
+		e.MaxShaderCompilerThreads = (Gl_max_shader_compiler_threads)
+			load("glMaxShaderCompilerThreadsKHR");
+	}
+	else if (gl_has_extension("GL_ARB_parallel_shader_compile")) {
+		e.parallel_compile = true;
+		e.MaxShaderCompilerThreads = (Gl_max_shader_compiler_threads)
+			load("glMaxShaderCompilerThreadsARB");
+	}
+	// As many threads as the driver likes
+	if (e.MaxShaderCompilerThreads)
+		e.MaxShaderCompilerThreads(0xFFFFFFFF);
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef GL_STATE_HH
+#define GL_STATE_HH
+
+#include <glad/glad.h>
+#include <iostream>
+
+/**
+ * Shadow copy of the GL bindings changed most often: the program, the
+ * texture of each unit, the vertex array and the framebuffers. The gl_*
+ * calls below replace the plain GL ones. They skip calls that would change
+ * nothing, and count both issued and skipped calls for profiling. Shader
+ * does the same for uniform values.
+ *
+ * Skipping is off until gl_state_enable(): code binding things with plain
+ * GL behind the cache's back would leave it wrong. Enable it once every
+ * bind of the application goes through here, or call gl_state_invalidate()
+ * after such code. Deletes go through here too, they unbind the objects.
+ */
+
+#define GL_STATE_UNITS   32 // Texture units tracked, others always bind
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+enum {
+	GL_STATE_TEXTURE_2D,
+	GL_STATE_TEXTURE_2D_ARRAY,
+	GL_STATE_TEXTURE_CUBE_MAP,
+	GL_STATE_TEXTURE_BUFFER,
+	GL_STATE_TARGETS
+};
+
+struct Gl_state_counters {
+	unsigned long programs;
+	unsigned long active_textures;
+	unsigned long textures;
+	unsigned long vertex_arrays;
+	unsigned long framebuffers;
+	unsigned long uniforms;
+};
+
+struct Gl_state {
+	bool enabled;
+	Gl_state_counters issued;
+	Gl_state_counters skipped;
+
+	// GL_STATE_UNKNOWN when it can't be trusted
+	GLuint program;
+	GLuint active_unit; // From 0, not GL_TEXTURE0
+	GLuint textures[GL_STATE_UNITS][GL_STATE_TARGETS];
+	GLuint vertex_array;
+	GLuint draw_framebuffer;
+	GLuint read_framebuffer;
+};
+
+inline void gl_state_invalidate(void);
+
+inline Gl_state &gl_state(void) {
+	static Gl_state s;
+	static bool initialized = false;
+	if (!initialized) {
+		initialized = true;
+		s.enabled = false;
+		s.issued = Gl_state_counters();
+		s.skipped = Gl_state_counters();
+		gl_state_invalidate();
+	}
+	return s;
+}
+
+// Forget every binding, the next call of each kind goes to GL
+inline void gl_state_invalidate(void) {
+	Gl_state &s = gl_state();
+	s.program = GL_STATE_UNKNOWN;
+	s.active_unit = GL_STATE_UNKNOWN;
+	for (int i = 0; i < GL_STATE_UNITS; i++)
+		for (int t = 0; t < GL_STATE_TARGETS; t++)
+			s.textures[i][t] = GL_STATE_UNKNOWN;
+	s.vertex_array = GL_STATE_UNKNOWN;
+	s.draw_framebuffer = GL_STATE_UNKNOWN;
+	s.read_framebuffer = GL_STATE_UNKNOWN;
+}
+
+inline void gl_state_enable(bool enabled) {
+	gl_state_invalidate();
+	gl_state().enabled = enabled;
+}
+
+inline void gl_state_reset_counters(void) {
+	gl_state().issued = Gl_state_counters();
+	gl_state().skipped = Gl_state_counters();
+}
+
+// Issued / skipped calls of each kind since the last reset
+inline void gl_state_report(void) {
+	const Gl_state &s = gl_state();
+	std::cout << "GL calls (issued / skipped): program " << s.issued.programs
+		<< " / " << s.skipped.programs << ", active texture "
+		<< s.issued.active_textures << " / " << s.skipped.active_textures
+		<< ", texture " << s.issued.textures << " / " << s.skipped.textures
+		<< ", vertex array " << s.issued.vertex_arrays << " / "
+		<< s.skipped.vertex_arrays << ", framebuffer "
+		<< s.issued.framebuffers << " / " << s.skipped.framebuffers
+		<< ", uniform " << s.issued.uniforms << " / " << s.skipped.uniforms
+		<< std::endl;
+}
+
+inline void gl_use_program(GLuint program) {
+	Gl_state &s = gl_state();
+	if (s.enabled && s.program == program) {
+		s.skipped.programs++;
+		return;
+	}
+	s.issued.programs++;
+	s.program = program;
+	glUseProgram(program);
+}
+
+// `unit` is GL_TEXTURE0 + i, as for glActiveTexture
+inline void gl_active_texture(GLenum unit) {
+	Gl_state &s = gl_state();
+	if (s.enabled && s.active_unit == unit - GL_TEXTURE0) {
+		s.skipped.active_textures++;
+		return;
+	}
+	s.issued.active_textures++;
+	s.active_unit = unit - GL_TEXTURE0;
+	glActiveTexture(unit);
+}
+
+inline int gl_state_target(GLenum target) {
+	switch (target) {
+	case GL_TEXTURE_2D: return GL_STATE_TEXTURE_2D;
+	case GL_TEXTURE_2D_ARRAY: return GL_STATE_TEXTURE_2D_ARRAY;
+	case GL_TEXTURE_CUBE_MAP: return GL_STATE_TEXTURE_CUBE_MAP;
+	case GL_TEXTURE_BUFFER: return GL_STATE_TEXTURE_BUFFER;
+	}
+	return -1;
+}
+
+// On the active unit
+inline void gl_bind_texture(GLenum target, GLuint texture) {
+	Gl_state &s = gl_state();
+	int t = gl_state_target(target);
+	GLuint *bound = t >= 0 && s.active_unit < GL_STATE_UNITS ?
+		&s.textures[s.active_unit][t] : NULL;
+	if (s.enabled && bound && *bound == texture) {
+		s.skipped.textures++;
+		return;
+	}
+	s.issued.textures++;
+	if (bound)
+		*bound = texture;
+	glBindTexture(target, texture);
+}
+
+inline void gl_bind_vertex_array(GLuint vertex_array) {
+	Gl_state &s = gl_state();
+	if (s.enabled && s.vertex_array == vertex_array) {
+		s.skipped.vertex_arrays++;
+		return;
+	}
+	s.issued.vertex_arrays++;
+	s.vertex_array = vertex_array;
+	glBindVertexArray(vertex_array);
+}
+
+inline void gl_bind_framebuffer(GLenum target, GLuint framebuffer) {
+	Gl_state &s = gl_state();
+	bool draw = target != GL_READ_FRAMEBUFFER;
+	bool read = target != GL_DRAW_FRAMEBUFFER;
+	if (s.enabled && (!draw || s.draw_framebuffer == framebuffer) &&
+			(!read || s.read_framebuffer == framebuffer)) {
+		s.skipped.framebuffers++;
+		return;
+	}
+	s.issued.framebuffers++;
+	if (draw)
+		s.draw_framebuffer = framebuffer;
+	if (read)
+		s.read_framebuffer = framebuffer;
+	glBindFramebuffer(target, framebuffer);
+}
+
+// Deleted objects are unbound by GL, their names can come back
+inline void gl_delete_textures(GLsizei n, const GLuint *textures) {
+	Gl_state &s = gl_state();
+	for (GLsizei i = 0; i < n; i++)
+		for (int u = 0; u < GL_STATE_UNITS; u++)
+			for (int t = 0; t < GL_STATE_TARGETS; t++)
+				if (s.textures[u][t] == textures[i])
+					s.textures[u][t] = 0;
+	glDeleteTextures(n, textures);
+}
+
+inline void gl_delete_vertex_arrays(GLsizei n, const GLuint *vertex_arrays) {
+	Gl_state &s = gl_state();
+	for (GLsizei i = 0; i < n; i++)
+		if (s.vertex_array == vertex_arrays[i])
+			s.vertex_array = 0;
+	glDeleteVertexArrays(n, vertex_arrays);
+}
+
+inline void gl_delete_framebuffers(GLsizei n, const GLuint *framebuffers) {
+	Gl_state &s = gl_state();
+	for (GLsizei i = 0; i < n; i++) {
+		if (s.draw_framebuffer == framebuffers[i])
+			s.draw_framebuffer = 0;
+		if (s.read_framebuffer == framebuffers[i])
+			s.read_framebuffer = 0;
+	}
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+// A program in use stays in use once deleted, but its name can be reused
+inline void gl_delete_program(GLuint program) {
+	Gl_state &s = gl_state();
+	if (s.program == program)
+		s.program = GL_STATE_UNKNOWN;
+	glDeleteProgram(program);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef IMAGE_LOADER_HH
+#define IMAGE_LOADER_HH
+
+#include <texture.hh>
+#include <texture_cache.hh>
+#include <mipmap.hh>
+#include <upload_ring.hh>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Decodes images on a pool of worker threads and uploads them to textures on
+ * the GL thread.
+ *
+ * load() returns right away with a texture that has no storage yet (samples
+ * black). Workers also build the mip chain (see Texture2D::mip_filter).
+ * Call upload() once per frame from the GL thread to move decoded pixels to
+ * the GPU, at most `budget_bytes` per call so big images are split over
+ * several frames, or finish() to block until everything is uploaded.
+ *
+ * With an UploadRing the workers copy the image and its mips into a mapped
+ * pixel buffer, and upload() only issues the transfers from it. Images that
+ * don't get a slot are uploaded from client memory.
+ */
+class ImageLoader {
+public:
+	// 0 threads = one per core
+	ImageLoader(unsigned int threads = 0, UploadRing *ring = NULL);
+	~ImageLoader();
+
+	Texture_handle load(const std::string &path, unsigned int location = 0,
+			bool verticalFlip = true, unsigned int wrapS = GL_REPEAT,
+			unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
+
+	// Upload decoded images. Returns the number of textures completed.
+	int upload(size_t budget_bytes = 4 * 1024 * 1024);
+	// Wait for every queued image and upload it
+	void finish(void);
+	// Images queued or waiting for upload
+	size_t pending(void);
+
+private:
+	struct Job {
+		std::string path;
+		bool flip;
+		Texture_usage usage;
+		Texture_handle texture;
+		Image image;
+		std::vector<Mip_level> mips; // Empty for driver mipmaps
+		int slot; // In the upload ring, -1 for client memory
+		bool ok;
+		int next_row; // Next row to upload
+	};
+
+	UploadRing *ring;
+	std::vector<std::thread> workers;
+	std::deque<Job> queue;   // Waiting to be decoded
+	std::deque<Job> decoded; // Waiting to be uploaded (GL thread)
+	size_t decoding;         // Jobs taken by workers
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	bool quit;
+
+	void worker(void);
+	void copy_to_ring(Job &j);
+};
+
+#endif
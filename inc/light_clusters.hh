@@ -0,0 +1,105 @@
+#ifndef LIGHT_CLUSTERS_HH
+#define LIGHT_CLUSTERS_HH
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <light_tiles.hh>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Clustered light culling: the screen tiles of LightTiles are also cut in
+ * depth, into slices growing exponentially from the near to the far plane
+ * of the projection. Each light is listed in the clusters (froxels) its
+ * sphere can touch, so a pixel in front of a light doesn't loop over it
+ * just because they share a tile.
+ *
+ * For every slice a light crosses, its sphere is clipped to the slice's
+ * depths before finding its screen rectangle: near its top and bottom a
+ * sphere covers fewer tiles. bin() runs on a pool of threads (slice s on
+ * thread s % threads), each builds the lists of its own clusters.
+ *
+ * Same buffers as LightTiles, bound the same way: lights, (first index,
+ * count) per cluster and indices. Cluster (x, y, slice) is entry
+ * (slice * tiles_y() + y) * tiles_x() + x. A fragment at eye depth z
+ * (positive) is in slice int(log(z) * slice_scale() + slice_bias()),
+ * clamped to the slices.
+ *
+ * The projection has to be a symmetric perspective (glm::perspective).
+ */
+class LightClusters {
+public:
+	// 0 threads = one per core
+	LightClusters(int width, int height, int tile_size = 32, int slices = 32,
+			unsigned int threads = 0);
+	~LightClusters();
+
+	void resize(int width, int height);
+
+	// Fills the cluster lists, no GL calls
+	void bin(const std::vector<Tile_light> &lights,
+			const glm::mat4 &projection);
+	// Sends the lights and the lists of the last bin()
+	void upload(const std::vector<Tile_light> &lights);
+	// Binds the lights, clusters and indices buffers to units first .. first + 2
+	void bind(unsigned int first_unit) const;
+
+	int tile_size(void) const { return size; }
+	int tiles_x(void) const { return columns; }
+	int tiles_y(void) const { return rows; }
+	int slices(void) const { return depth_slices; }
+	// Of the last bin()
+	float slice_scale(void) const { return scale; }
+	float slice_bias(void) const { return bias; }
+	// Light references in every list, over the number of clusters
+	float average_per_cluster(void) const;
+	int max_per_cluster(void) const;
+
+private:
+	int width, height;
+	int size;
+	int columns, rows;
+	int depth_slices;
+	float scale, bias;
+	std::vector<float> slice_depth; // Slice s from slice_depth[s] to [s + 1]
+
+	// Depth range of each light, in slices, first > last if none
+	std::vector<int> first_slice, last_slice;
+	std::vector<GLuint> clusters; // Offset, count per cluster
+
+	// What each thread built
+	struct Chunk {
+		std::vector<GLuint> indices;
+		std::vector<int> rects; // Light, cluster of its first tile, x1, y1
+		GLuint base;            // Of its indices, in the whole list
+	};
+	std::vector<Chunk> chunks;
+	GLuint total;
+
+	// Parameters of the bin() in progress, for the workers
+	const std::vector<Tile_light> *job_lights;
+	float sx, sy;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	unsigned int generation; // Bumped for every bin()
+	unsigned int running;    // Workers not done with the current one
+	bool quit;
+
+	GLuint buffers[3];  // Lights, clusters, indices
+	GLuint textures[3];
+	size_t capacity[3]; // Bytes allocated for each buffer
+
+	void worker(unsigned int i);
+	void bin_chunk(unsigned int i);
+	void reserve(int i, size_t bytes);
+
+	LightClusters(const LightClusters &);
+	LightClusters &operator=(const LightClusters &);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef LIGHT_TILES_HH
+#define LIGHT_TILES_HH
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * Tiled light culling for deferred shading. The screen is cut in square
+ * tiles (16x16 pixels by default), and each light of finite radius is
+ * listed in the tiles its sphere can touch. The lighting pass then loops
+ * over the lights of its tile only, instead of over every light.
+ *
+ * bin() runs on the CPU: the screen rectangle of 4 lights at a time is
+ * computed with SSE2 (plain C++ elsewhere), from the eye space bounding box
+ * of each sphere. Spheres crossing the near plane cover the whole screen.
+ * There's no depth test per tile, the depth buffer stays on the GPU.
+ *
+ * upload() fills three texture buffers, read with texelFetch (lights.glsl):
+ *   lights  RGBA32F, 2 texels per light: eye position + radius, color
+ *   tiles   RG32UI, per tile (row by row from the bottom left): first entry
+ *           in `indices`, number of lights
+ *   indices R32UI, light numbers, tile after tile
+ *
+ * The projection has to be a symmetric perspective (glm::perspective).
+ */
+
+struct Tile_light {
+	glm::vec4 position; // Eye space xyz, radius in w
+	glm::vec4 color;    // rgb, a unused
+};
+
+class LightTiles {
+public:
+	LightTiles(int width, int height, int tile_size = 16);
+	~LightTiles();
+
+	void resize(int width, int height);
+
+	// Fills the tile lists, no GL calls
+	void bin(const std::vector<Tile_light> &lights,
+			const glm::mat4 &projection);
+	// Sends the lights and the lists of the last bin()
+	void upload(const std::vector<Tile_light> &lights);
+	// Binds the lights, tiles and indices buffers to units first .. first + 2
+	void bind(unsigned int first_unit) const;
+
+	int tile_size(void) const { return size; }
+	int tiles_x(void) const { return columns; }
+	int tiles_y(void) const { return rows; }
+	// Light references in every list, over the number of tiles
+	float average_per_tile(void) const;
+	int max_per_tile(void) const;
+
+private:
+	int width, height;
+	int size;
+	int columns, rows;
+
+	// Tile rectangle of each light, x1 < x0 if off screen
+	std::vector<int> x0, x1, y0, y1;
+	std::vector<GLuint> tiles;   // Offset, count per tile
+	std::vector<GLuint> indices;
+
+	GLuint buffers[3];  // Lights, tiles, indices
+	GLuint textures[3];
+	size_t capacity[3]; // Bytes allocated for each buffer
+
+	void light_rects(const std::vector<Tile_light> &lights,
+			const glm::mat4 &projection);
+	void send(int i, const void *data, size_t bytes);
+
+	LightTiles(const LightTiles &);
+	LightTiles &operator=(const LightTiles &);
+};
+
+#endif
@@ -22,6 +22,7 @@ struct vec2 {
  * 0 - Position
  * 1 - Normal
  * 2 - Texture coords
+ * 3 - Material index (unsigned int, constant for the whole mesh)
  */
 
 struct Vertex {
@@ -34,19 +35,24 @@ class Mesh {
 public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
+	unsigned int material; // Slot in the TextureArray of the model
 
 	void setup_gpu(void);
 	void draw(void);
 	void free_gpu(void);
-	Mesh() : did_setup(false) {}
+	// Surface area and UV area of all the triangles, for texel density
+	void uv_area(float &area, float &uv) const;
+	Mesh() : material(0), did_setup(false) {}
 
 	Mesh(const Mesh &old) noexcept : vertices(old.vertices),
-			indices(old.indices), did_setup(old.did_setup) {
+			indices(old.indices), material(old.material),
+			did_setup(old.did_setup) {
 		did_setup = false;
 	}
 
 	Mesh(Mesh &&old) noexcept : vertices(move(old.vertices)),
-			indices(move(old.indices)), did_setup(old.did_setup) {
+			indices(move(old.indices)), material(old.material),
+			did_setup(old.did_setup) {
 		did_setup = false;
 	}
 
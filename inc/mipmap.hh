@@ -0,0 +1,38 @@
+#ifndef MIPMAP_HH
+#define MIPMAP_HH
+
+#include <texture.hh>
+#include <vector>
+
+/**
+ * CPU mip chain generator, used instead of glGenerateMipmap by Texture2D and
+ * by texbake.
+ *
+ * Filtering happens in linear light: color channels are decoded from sRGB
+ * before filtering and encoded again after, alpha stays linear. Masks are
+ * filtered as is, normal maps (3+ channels) are renormalized on every level.
+ * Each level is filtered from the unquantized previous one.
+ *
+ * MIP_BOX is a 2x2 average, MIP_KAISER a Kaiser windowed sinc over 8x8
+ * texels (sharper, keeps more detail in the small levels). Rows are split
+ * over `threads` threads (0 = one per core). The filter loops use AVX2 or
+ * SSE2 when the CPU has them and plain C++ otherwise.
+ *
+ * Odd sizes are halved rounding down, clamping at the last row / column.
+ */
+
+struct Mip_level {
+	int width, height;
+	std::vector<unsigned char> pixels; // Same channels as the source
+};
+
+// Builds levels 1 .. n (down to 1x1) of an image with `channels` bytes / pixel
+void mip_generate(const unsigned char *pixels, int width, int height,
+		int channels, std::vector<Mip_level> &levels,
+		Mip_filter filter = MIP_BOX, Texture_usage usage = TEXTURE_COLOR,
+		unsigned int threads = 0);
+
+// Instruction set picked at run time: "avx2", "sse2" or "scalar"
+const char *mip_isa(void);
+
+#endif
@@ -5,7 +5,7 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <mesh.hh>
-//#include <texture.hh>
+#include <texture_array.hh>
 #include <vector>
 #include <iostream>
 
@@ -17,9 +17,26 @@ public:
 	void setup_gpu(void);
 	void draw(void);
 
+	/**
+	 * Adds the diffuse map of every material to `textures` (a solid color
+	 * for materials without one) and points the meshes at their slots, so
+	 * the whole model draws with one texture binding.
+	 */
+	void load_textures(TextureArray &textures, bool verticalFlip = true);
+
+	// World units covered by one UV unit, averaged over the surface. For
+	// TextureStreamer::use().
+	float uv_scale(void) const;
+
 private:
+	struct Material {
+		std::string diffuse_map; // Relative to the model file
+		float color[3];
+	};
+
+	std::string directory;
 	vector<Mesh> meshes;
-	//vector<Texture2D *> textures;
+	vector<Material> materials;
 
 	void process_node(aiNode *node, const aiScene *scene);
 	void process_mesh(aiMesh *mesh, const aiScene *scene);
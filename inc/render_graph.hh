@@ -0,0 +1,124 @@
+#ifndef RENDER_GRAPH_HH
+#define RENDER_GRAPH_HH
+
+#include <glad/glad.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+ * Frame graph of full screen passes and the textures between them. Every
+ * frame, the passes are declared in execution order with the textures they
+ * read and write, then execute() runs those the frame's output depends on:
+ * a pass writing nothing read later (and not the default framebuffer) is
+ * culled, with its textures.
+ *
+ * Transient textures are only defined from the pass writing them to the
+ * last one reading them, within the frame. They are taken from a pool, and
+ * two of the same format and size share one GL texture when their
+ * lifetimes don't overlap. Persistent ones keep their contents from frame
+ * to frame (histories), are never shared and are freed once no longer
+ * declared.
+ *
+ * Allocation only happens when the declarations or the size changed since
+ * the last frame: resize() just records the size. GL textures
+ * and framebuffers still matching are kept, so two alternating setups (a
+ * ping-pong) don't recreate anything.
+ *
+ * Each pass with outputs gets a framebuffer with them attached (color in
+ * order, depth formats on the depth attachment), bound with the viewport
+ * set to their size before its callback runs.
+ */
+
+struct Rg_texture {
+	GLint internal_format;
+	GLenum format, type;  // Of glTexImage2D, no data is sent
+	GLint filter;         // GL_NEAREST or GL_LINEAR
+	int divisor;          // Of the graph's size, rounded up
+};
+
+class RenderGraph {
+public:
+	typedef int Resource;
+	// Output of the passes drawing to the default framebuffer
+	static const Resource BACKBUFFER = -1;
+
+	RenderGraph();
+	~RenderGraph();
+
+	// Applied by the next execute()
+	void resize(int width, int height);
+
+	// Declarations, for this frame only
+	Resource texture(const char *name, const Rg_texture &desc,
+			bool persistent = false);
+	void pass(const char *name, const std::vector<Resource> &inputs,
+			const std::vector<Resource> &outputs,
+			std::function<void(void)> run);
+
+	// Runs the live passes, the next frame declares everything again
+	void execute(void);
+
+	// Valid in the callbacks of the passes using `r`
+	GLuint gl_texture(Resource r) const;
+	int width(Resource r) const;
+	int height(Resource r) const;
+	// Framebuffer of the pass writing `r`, 0 for the backbuffer
+	GLuint framebuffer(Resource r) const;
+	// Allocated by this execute(), its contents are undefined
+	bool created(Resource r) const;
+
+	// Of the last allocation
+	int live_passes(void) const { return live_count; }
+	size_t texture_bytes(void) const;
+
+private:
+	struct Texture {
+		std::string name;
+		Rg_texture desc;
+		bool persistent;
+	};
+	struct Pass {
+		std::string name;
+		std::vector<Resource> inputs, outputs;
+		std::function<void(void)> run;
+		bool live;
+	};
+	// One GL texture
+	struct Physical {
+		Rg_texture desc;
+		int w, h;
+		GLuint texture;
+		std::string owner; // Name of its persistent texture, "" if pooled
+	};
+
+	int screen_w, screen_h;
+	// Last frame's declarations, overwritten by this one's
+	std::vector<Texture> textures;
+	std::vector<Pass> passes;
+	unsigned int texture_count, pass_count; // Declared so far this frame
+	bool changed; // Since the last allocation
+	std::vector<Physical> pool;
+	std::map<std::vector<GLuint>, GLuint> framebuffers; // By attachments
+
+	// Entry of `pool` per declared texture (-1 if unused) and framebuffer
+	// per pass, kept while the declarations don't change
+	std::vector<int> assigned;
+	std::vector<bool> fresh;
+	std::vector<GLuint> pass_framebuffers;
+	int live_count;
+
+	void cull(void);
+	void allocate(void);
+	int find_physical(const Rg_texture &desc, int w, int h,
+			const std::string &owner, std::vector<bool> &taken);
+	GLuint make_framebuffer(const Pass &p);
+	void free_framebuffers(GLuint texture = 0);
+	void size_of(const Rg_texture &desc, int &w, int &h) const;
+
+	RenderGraph(const RenderGraph &);
+	RenderGraph &operator=(const RenderGraph &);
+};
+
+#endif
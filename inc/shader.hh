@@ -5,20 +5,120 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <functional>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * FNV-1a hash of a uniform name. constexpr, so "view"_u is computed at
+ * compile time and looking it up needs no string at all.
+ */
+typedef uint32_t Uniform_id;
+
+constexpr Uniform_id uniform_id(const char *name,
+		Uniform_id hash = 2166136261u) {
+	return *name ? uniform_id(name + 1,
+			(hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+constexpr Uniform_id operator"" _u(const char *name, size_t) {
+	return uniform_id(name);
+}
+
+/**
+ * Typed reference to a uniform of one shader: its slot in the shader's
+ * uniform table, so setting it is an array read and a glUniform call.
+ * Handles stay valid when the program is linked again. Elements of a
+ * uniform array have consecutive slots, handle[i] is element i.
+ */
+template <typename T>
+struct UniformHandle {
+	int slot; // -1 if the shader has no such uniform
+
+	UniformHandle(int slot = -1) : slot(slot) {}
+	bool valid(void) const { return slot >= 0; }
+	UniformHandle operator[](int i) const {
+		return UniformHandle(slot >= 0 ? slot + i : -1);
+	}
+};
+
+/**
+ * Preprocessor symbols injected right after #version, {{"LIGHT_COUNT", "20"},
+ * {"USE_SSAO", "1"}}. Each set of defines is its own program (permutation):
+ * constants the compiler sees can unroll loops and drop whole branches.
+ */
+typedef std::vector<std::pair<std::string, std::string> > Shader_defines;
 
 class Shader {
 public:
 	// Program ID
 	unsigned int ID;
 
-	// Loads and compiles the shader
-	Shader(const GLchar* vertexPath, const GLchar* fragmentPath);
+	/**
+	 * Linked programs are saved to `cache_dir` (glGetProgramBinary) and
+	 * loaded from there when the sources, vendor, renderer and GL version
+	 * all match. Binaries the driver rejects are compiled again from source.
+	 * Empty disables the cache, so does a driver without binary formats or
+	 * without gl_ext_load().
+	 */
+	static std::string cache_dir;       // ".shader_cache" by default
+	static unsigned int cache_hits;     // Programs loaded from the cache
+	static unsigned int cache_misses;   // Programs compiled from source
 
-	// Activate the shader
-	void use();
+	/**
+	 * Loads and compiles the shader. With wait = false it returns as soon as
+	 * compiling started and errors are reported later, by finish().
+	 *
+	 * Sources may use #include "file", relative to the including file and
+	 * read once per stage. Errors name each file by its number (the source
+	 * string of #line), the list of files is printed with them.
+	 */
+	Shader(const GLchar* vertexPath, const GLchar* fragmentPath,
+			const Shader_defines &defines = Shader_defines(), bool wait = true);
+
+	/**
+	 * Activate the shader. The first use() of a program still compiling
+	 * waits for it (finish()), unless it has a fallback: then the fallback
+	 * is bound until the program is ready() and use() returns false.
+	 */
+	bool use();
+
+	/**
+	 * Deferred compiling. ready() never blocks, but only knows the answer
+	 * with KHR_parallel_shader_compile; without it, it's always true and
+	 * finish() may wait. finish() checks for errors, reads the uniforms and
+	 * runs the onReady() callbacks with the program bound.
+	 *
+	 * Until then uniform setters do nothing and handles are invalid, so do
+	 * one-time setup (sampler units...) in onReady(). bindBlock() is kept
+	 * and applied after linking.
+	 */
+	bool ready(void) const;
+	void finish(void);
+	bool pending(void) const { return linking; }
+	void setFallback(Shader *fallback) { this->fallback = fallback; }
+	void onReady(const std::function<void(Shader &)> &callback);
+
+	/**
+	 * Hot reload. reload() reads the sources again and starts compiling a
+	 * new program while the current one stays in use. swapReloaded(), called
+	 * between frames, puts it in place once it's linked (never waits with
+	 * KHR_parallel_shader_compile): uniform values are copied from the old
+	 * program, handles and block bindings stay valid. Returns 1 once
+	 * swapped, 0 while compiling, -1 if the new program failed to build; the
+	 * old one is kept then.
+	 */
+	void reload(void);
+	int swapReloaded(void);
+	bool reloading(void) const { return next_ID != 0; }
+	// Every file the program was built from, includes too
+	const std::vector<std::string> &sources(void) const { return files; }
 
 	// Uniform functions
 	void setBool(const std::string &name, bool value) const;
@@ -32,8 +132,161 @@ public:
 	void setVec(const std::string &name, const glm::vec4 &value) const;
 	unsigned int getLocation(const std::string &name) const;
 
+	// Same by hashed name, setMat("view"_u, view)
+	void setBool(Uniform_id id, bool value) const;
+	void setInt(Uniform_id id, int value) const;
+	void setFloat(Uniform_id id, float value) const;
+	void setMat(Uniform_id id, const glm::mat2 &value) const;
+	void setMat(Uniform_id id, const glm::mat3 &value) const;
+	void setMat(Uniform_id id, const glm::mat4 &value) const;
+	void setVec(Uniform_id id, const glm::vec2 &value) const;
+	void setVec(Uniform_id id, const glm::vec3 &value) const;
+	void setVec(Uniform_id id, const glm::vec4 &value) const;
+
+	// Handles, looked up once. Warns if the uniform is missing or its type
+	// doesn't match T. Use int for samplers and bools.
+	template <typename T>
+	UniformHandle<T> uniform(const std::string &name) const {
+		int slot = findSlot(uniform_id(name.c_str()));
+		if (linking)
+			std::cout << "Uniform '" << name << "' looked up before linking"
+				<< std::endl;
+		else if (slot < 0)
+			std::cout << "Uniform '" << name << "' not found" << std::endl;
+		else
+			checkType(slot, typeOf((T *)NULL));
+		return UniformHandle<T>(slot);
+	}
+
+	void set(UniformHandle<int> h, int value) const;
+	void set(UniformHandle<float> h, float value) const;
+	void set(UniformHandle<glm::mat2> h, const glm::mat2 &value) const;
+	void set(UniformHandle<glm::mat3> h, const glm::mat3 &value) const;
+	void set(UniformHandle<glm::mat4> h, const glm::mat4 &value) const;
+	void set(UniformHandle<glm::vec2> h, const glm::vec2 &value) const;
+	void set(UniformHandle<glm::vec3> h, const glm::vec3 &value) const;
+	void set(UniformHandle<glm::vec4> h, const glm::vec4 &value) const;
+	// `count` array elements from h on, in one call
+	void set(UniformHandle<glm::vec3> h, const glm::vec3 *values,
+			int count) const;
+	void set(UniformHandle<glm::vec4> h, const glm::vec4 *values,
+			int count) const;
+
+	// GL location of a slot, -1 (ignored by glUniform) for missing uniforms
+	GLint location(int slot) const {
+		return slot >= 0 ? uniforms[slot].location : -1;
+	}
+
+	/**
+	 * Uniform blocks (see UniformBuffer). bindBlock() attaches a block to a
+	 * binding point, and keeps it attached across relinks. blockSize() and
+	 * offsetOf() give the layout the driver chose (std140 blocks follow the
+	 * standard rules); both return -1 for unknown names.
+	 */
+	void bindBlock(const std::string &name, unsigned int binding);
+	GLint blockSize(const std::string &name) const;
+	GLint offsetOf(const std::string &member) const;
+
+private:
+	/**
+	 * Every active uniform, filled by reflectUniforms() after linking. Array
+	 * elements get a slot each, the array name shares the first one.
+	 * Members of uniform blocks have no location but an offset.
+	 */
+	struct Uniform {
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint block;  // Uniform block index, -1 for plain uniforms
+		GLint offset; // Bytes from the start of the block
+		// Last value set, to skip setting it again. 0 bytes if unknown.
+		mutable unsigned char value[64];
+		mutable size_t value_size;
+	};
+	std::vector<Uniform> uniforms;
+	std::vector<std::pair<Uniform_id, int> > index; // Sorted, id -> slot
+
+	struct Block {
+		std::string name;
+		GLint index; // -1 if not in the current program
+		GLint size;
+		GLint binding; // -1 until bindBlock()
+	};
+	std::vector<Block> blocks;
+
+	bool linking;             // Submitted, finish() not done yet
+	unsigned int stages[2];   // Vertex and fragment shader until finish()
+	uint64_t key;             // Of the sources, for the binary cache
+	Shader *fallback;
+	std::vector<std::function<void(Shader &)> > ready_callbacks;
+	std::vector<std::string> files; // Source files, by #line number
+
+	std::string vertex_path, fragment_path;
+	Shader_defines defines;
+	unsigned int next_ID;           // reload() in progress, 0 if none
+	unsigned int next_stages[2];
+	uint64_t next_key;
+	std::vector<std::string> next_files;
+
+	bool checkCompileErrors(unsigned int shader, std::string type,
+			const std::vector<std::string> &paths);
+	bool readSources(std::string &vertexCode, std::string &fragmentCode,
+			std::vector<std::string> &paths) const;
+	unsigned int compile(const std::string &vertexCode,
+			const std::string &fragmentCode, unsigned int *stages);
+	bool checkErrors(unsigned int program, unsigned int *stages,
+			const std::vector<std::string> &paths);
+	void dropReload(void);
+	bool loadBinary(uint64_t key);
+	void saveBinary(uint64_t key);
+	void reflectUniforms(void);
+	void reflectBlocks(void);
+	int addSlot(Uniform_id id, const std::string &name);
+	int findSlot(Uniform_id id) const;
+	int slotOf(const std::string &name) const;
+	int slotOf(Uniform_id id) const;
+	bool changed(int slot, const void *value, size_t size) const;
+	void forget(int slot, int count) const;
+	void checkType(int slot, GLenum expected) const;
+	static bool isFloatType(GLenum type);
+	static void restoreUniform(GLint location, GLenum type, const GLfloat *f,
+			const GLint *i);
+
+	static GLenum typeOf(int *) { return GL_INT; }
+	static GLenum typeOf(float *) { return GL_FLOAT; }
+	static GLenum typeOf(glm::mat2 *) { return GL_FLOAT_MAT2; }
+	static GLenum typeOf(glm::mat3 *) { return GL_FLOAT_MAT3; }
+	static GLenum typeOf(glm::mat4 *) { return GL_FLOAT_MAT4; }
+	static GLenum typeOf(glm::vec2 *) { return GL_FLOAT_VEC2; }
+	static GLenum typeOf(glm::vec3 *) { return GL_FLOAT_VEC3; }
+	static GLenum typeOf(glm::vec4 *) { return GL_FLOAT_VEC4; }
+};
+
+/**
+ * Compiles several programs at once: add() submits each one without
+ * waiting, so the driver (with KHR_parallel_shader_compile, on several
+ * threads) works on all of them while the application goes on. The
+ * shaders live as long as the batch.
+ *
+ * Programs are kept by permutation, files and defines: adding the same
+ * ones again returns the program already there, so variants can be asked
+ * for when needed and are only compiled once.
+ */
+class ShaderBatch {
+public:
+	Shader &add(const GLchar *vertexPath, const GLchar *fragmentPath,
+			const Shader_defines &defines = Shader_defines());
+	// Every program linked, never blocks
+	bool ready(void) const;
+	// Waits for every program and reports errors
+	void finish(void);
+	int size(void) const { return shaders.size(); }
+	std::list<Shader>::iterator begin(void) { return shaders.begin(); }
+	std::list<Shader>::iterator end(void) { return shaders.end(); }
+
 private:
-	void checkCompileErrors(unsigned int shader, std::string type);
+	std::list<Shader> shaders;
+	std::map<std::string, Shader *> permutations;
 };
 
 #endif
@@ -0,0 +1,43 @@
+#ifndef SHADER_WATCHER_HH
+#define SHADER_WATCHER_HH
+
+#include <shader.hh>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Reloads shaders when one of their source files (includes too) is saved,
+ * so they can be tuned without restarting the demo. Call update() once per
+ * frame, before drawing: changed shaders start compiling again, and those
+ * done are swapped in (Shader::reload()). A shader that fails to compile
+ * keeps running the previous program.
+ *
+ * Uses inotify on the directories of the files, which also catches editors
+ * that save by renaming a new file over the old one. Does nothing on
+ * systems without inotify.
+ */
+class ShaderWatcher {
+public:
+	ShaderWatcher();
+	~ShaderWatcher();
+
+	void watch(Shader &shader);
+	void watch(ShaderBatch &batch);
+
+	// Number of shaders swapped in
+	int update(void);
+
+private:
+	int fd;                          // inotify instance, -1 if none
+	std::map<int, std::string> dirs; // Watch descriptor -> directory prefix
+	std::vector<Shader *> shaders;
+
+	void watch_files(const Shader &shader);
+	bool uses(const Shader &shader, const std::string &path) const;
+
+	ShaderWatcher(const ShaderWatcher &);
+	ShaderWatcher &operator=(const ShaderWatcher &);
+};
+
+#endif
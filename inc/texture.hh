@@ -3,19 +3,130 @@
 
 #include <glad/glad.h>
 #include <string>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Decoded 8 bit image, rows tightly packed.
+ */
+struct Image {
+	int width, height, channels;
+	std::shared_ptr<unsigned char> pixels;
+
+	Image() : width(0), height(0), channels(0) {}
+	size_t row_bytes(void) const { return (size_t)width * channels; }
+};
+
+/**
+ * Decodes an image file. Unlike stbi_set_flip_vertically_on_load() the flip is
+ * done per call, so this is safe to call from several threads at once.
+ */
+bool load_image(const std::string &path, bool verticalFlip, Image &img);
+
+/**
+ * What the texture holds, used to pick the smallest format that can store it:
+ *   TEXTURE_COLOR      - R8 / RG8 (grey, grey + alpha, swizzled), RGB8, RGBA8
+ *   TEXTURE_COLOR_SRGB - SRGB8, SRGB8_ALPHA8. Sampling returns linear values,
+ *                        only useful when the output is gamma corrected.
+ *                        There are no 1 / 2 channel sRGB formats in core GL,
+ *                        those use TEXTURE_COLOR.
+ *   TEXTURE_NORMAL     - RG8, shaders rebuild Z
+ *   TEXTURE_MASK       - R8, first channel only
+ */
+enum Texture_usage {
+	TEXTURE_COLOR,
+	TEXTURE_COLOR_SRGB,
+	TEXTURE_NORMAL,
+	TEXTURE_MASK,
+};
+
+/**
+ * How mip levels are made (see mipmap.hh):
+ *   MIP_DRIVER - glGenerateMipmap
+ *   MIP_BOX    - CPU, 2x2 box filter in linear light
+ *   MIP_KAISER - CPU, Kaiser windowed sinc in linear light
+ */
+enum Mip_filter {
+	MIP_DRIVER,
+	MIP_BOX,
+	MIP_KAISER,
+};
+
+struct Mip_level;
+
+struct Texture_format {
+	GLenum internal_format;
+	GLenum format;     // Pixel format of the uploaded data
+	int texel_bytes;   // As stored by the GPU
+	GLint swizzle[4];
+};
+
+Texture_format choose_texture_format(int channels, Texture_usage usage);
 
 class Texture2D {
 public:
 	unsigned int ID;
+	int width, height;
+	size_t gpu_bytes; // Estimated GPU memory, including the mip chain
+	static size_t total_gpu_bytes; // Sum over every live texture
+	static Mip_filter mip_filter;  // For decoded images, MIP_BOX by default
+
+	// Loads and uploads the image synchronously. Baked .ktex files (see
+	// texture_file.hh) are mapped and uploaded with their stored mip chain.
 	Texture2D(const std::string &path, unsigned int location = 0,
 			bool verticalFlip = true, unsigned int wrapS = GL_REPEAT,
-			unsigned int wrapT = GL_REPEAT);
+			unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
+
+	// Uploads an already decoded image
+	Texture2D(const Image &img, unsigned int location = 0,
+			unsigned int wrapS = GL_REPEAT, unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
+
+	// Texture without storage. Fill it with allocate() + upload_rows()
+	Texture2D(unsigned int location, unsigned int wrapS = GL_REPEAT,
+			unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
 
 	void bind(void) const;
 	void activateAndBind(void) const;
+	void activateAndBind(unsigned int location) const;
+	void free_gpu(void);
+
+	// Incremental upload. Finish with either finish_upload(), which has the
+	// driver generate the mip chain, or upload_mips(). Both turn on
+	// trilinear filtering, until then only level 0 is sampled.
+	void allocate(int width, int height, int channels);
+	void upload_rows(const Image &img, int first_row, int rows);
+	void finish_upload(void);
+	void upload_mips(const std::vector<Mip_level> &levels); // Levels 1 .. n
+
+	// Same, reading from `pixels`, which may also be an offset into the bound
+	// GL_PIXEL_UNPACK_BUFFER (see UploadRing). Rows start at `first_row`,
+	// levels are packed one after the other, only their sizes are taken
+	// from `levels`.
+	void upload_rows(const unsigned char *pixels, int first_row, int rows);
+	void upload_mips(const std::vector<Mip_level> &levels,
+			const unsigned char *pixels);
+	bool ready(void) const { return uploaded; }
 
 private:
+	friend class TextureStreamer; // Manages the mip levels itself
+
 	unsigned int location;
+	int channels;
+	bool uploaded;
+	bool immutable; // Storage from glTexStorage2D
+	Texture_usage usage;
+
+	void setup(unsigned int wrapS, unsigned int wrapT);
+	void make_mips(const Image &img);
+	void use_mips(void);
+	void upload_level(int level, int width, int height,
+			const unsigned char *pixels);
+	void set_gpu_bytes(size_t bytes);
+	bool load_baked(const std::string &path, bool verticalFlip);
 };
 
 #endif
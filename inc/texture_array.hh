@@ -0,0 +1,82 @@
+#ifndef TEXTURE_ARRAY_HH
+#define TEXTURE_ARRAY_HH
+
+#include <glad/glad.h>
+#include <texture.hh>
+#include <string>
+#include <vector>
+
+/**
+ * Where an image ended up in a TextureArray, in UV units of its layer.
+ * Shaders sample it with
+ *   texture(array, vec3(slot.xy + fract(uv) * slot.zw, layer))
+ * (textureGrad with the derivatives of uv * slot.zw, to keep mipmapping
+ * right across the fract() seam).
+ */
+struct Texture_slot {
+	int layer;
+	float u, v;          // Bottom left corner
+	float width, height;
+};
+
+/**
+ * GL_TEXTURE_2D_ARRAY holding many textures so a whole scene is drawn with a
+ * single texture binding.
+ *
+ * Images with the size of a layer take a whole layer. Smaller ones are packed
+ * on shelves, several per layer, each surrounded by `padding` texels copied
+ * from the opposite edge (so GL_REPEAT style wrapping with fract() has no
+ * seam) and placed on a multiple of `padding`. That keeps mip levels up to
+ * log2(padding) from bleeding between neighbours, and the mip chain stops
+ * there. Arrays with only whole layers get the full chain.
+ *
+ * Images are converted to RGBA and kept in memory until build() uploads them.
+ */
+class TextureArray {
+public:
+	unsigned int ID;
+	int width, height; // Layer size
+	size_t gpu_bytes;
+
+	TextureArray(int width, int height, unsigned int location = 0,
+			int padding = 8, Texture_usage usage = TEXTURE_COLOR);
+
+	// Return the slot index, or -1 if the image doesn't fit in a layer
+	int add(const Image &img);
+	int add(const std::string &path, bool verticalFlip = true);
+	// Solid color, for materials without a texture
+	int add_color(float r, float g, float b, float a = 1.0f);
+
+	// Uploads every layer and generates the mip chain
+	void build(void);
+
+	int layers(void) const { return pages.size(); }
+	int size(void) const { return slots.size(); }
+	const Texture_slot &slot(int i) const { return slots[i]; }
+
+	void bind(void) const;
+	void activateAndBind(void) const;
+	void free_gpu(void);
+
+private:
+	struct Shelf {
+		int layer;
+		int y, height;
+		int x; // First free column
+	};
+
+	unsigned int location;
+	int padding;
+	Texture_usage usage;
+	bool packed; // Some layer holds more than one image
+	std::vector<Texture_slot> slots;
+	std::vector<Shelf> shelves;
+	std::vector<int> page_top; // First free row of each layer
+	std::vector<std::vector<unsigned char> > pages; // RGBA, until build()
+
+	int new_page(void);
+	bool place(int w, int h, int &layer, int &x, int &y);
+	void blit(const Image &img, int layer, int x, int y, int pad);
+};
+
+#endif
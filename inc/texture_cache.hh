@@ -0,0 +1,75 @@
+#ifndef TEXTURE_CACHE_HH
+#define TEXTURE_CACHE_HH
+
+#include <texture.hh>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <ostream>
+
+/**
+ * Reference counted texture handle. The GPU texture is freed when the last
+ * handle (including the one held by the cache) goes away.
+ */
+typedef std::shared_ptr<Texture2D> Texture_handle;
+
+// Takes ownership of a heap allocated texture
+Texture_handle make_texture_handle(Texture2D *t);
+
+/**
+ * Shares Texture2D objects between everyone loading the same file with the
+ * same sampling parameters. Each image is decoded and uploaded only once
+ * while it's resident.
+ *
+ * Textures no longer referenced outside the cache stay resident until the
+ * budget is exceeded, then they are evicted least recently used first.
+ * Textures still in use are never evicted, so the budget can be overrun.
+ *
+ * Note: the texture unit passed to load() is the one used by
+ * Texture2D::activateAndBind(void) of the texture that was first loaded.
+ * Use activateAndBind(unit) to bind a shared texture to another unit.
+ */
+class TextureCache {
+public:
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+
+	TextureCache(size_t budget_bytes = 256 * 1024 * 1024);
+	~TextureCache();
+
+	Texture_handle load(const std::string &path, unsigned int location = 0,
+			bool verticalFlip = true, unsigned int wrapS = GL_REPEAT,
+			unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
+
+	void set_budget(size_t bytes);
+	size_t budget(void) const { return budget_bytes; }
+	size_t resident_bytes(void) const { return resident; }
+	size_t size(void) const { return entries.size(); }
+
+	// Evict unused textures until we are under budget
+	void trim(void);
+	// Drop every unused texture
+	void clear_unused(void);
+	void print_stats(std::ostream &out) const;
+
+private:
+	struct Entry {
+		std::string key;
+		Texture_handle texture;
+	};
+	typedef std::list<Entry> Lru_list; // Most recently used first
+
+	Lru_list lru;
+	std::unordered_map<std::string, Lru_list::iterator> entries;
+	size_t budget_bytes;
+	size_t resident;
+
+	void evict(Lru_list::iterator it);
+	static std::string make_key(const std::string &path, bool verticalFlip,
+			unsigned int wrapS, unsigned int wrapT, Texture_usage usage);
+};
+
+#endif
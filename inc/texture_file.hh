@@ -0,0 +1,86 @@
+#ifndef TEXTURE_FILE_HH
+#define TEXTURE_FILE_HH
+
+#include <stdint.h>
+#include <texture.hh>
+#include <string>
+#include <vector>
+
+/**
+ * Baked texture file (.ktex), written by texbake and loaded by Texture2D.
+ * Holds the whole mip chain already in the format passed to GL, so loading
+ * is just mmap + one glTexImage2D per level.
+ *
+ * Levels are either raw pixels (format / type set) or BC1 / BC3 / BC5 blocks
+ * (format = 0, see bc_encoder.hh) uploaded with glCompressedTexImage2D.
+ *
+ * Layout (native endianness):
+ *   Texture_file_header
+ *   Texture_file_level[header.levels]
+ *   level data, each level at its own offset
+ */
+
+#define TEXTURE_FILE_MAGIC "PUCKTEX1"
+#define TEXTURE_FILE_EXT   ".ktex"
+
+enum {
+	TEXTURE_FILE_FLIPPED = 1, // Rows stored bottom to top (verticalFlip)
+};
+
+struct Texture_file_header {
+	char magic[8];
+	uint32_t internal_format; // GL internal format
+	uint32_t format;          // GL pixel format, 0 if compressed
+	uint32_t type;            // GL pixel type, 0 if compressed
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;        // Channels in the source image
+	uint32_t levels;
+	uint32_t flags;
+};
+
+struct Texture_file_level {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset; // From the start of the file
+	uint64_t size;   // Bytes
+};
+
+// A .ktex file mapped in memory
+struct Texture_file_map {
+	const unsigned char *data;
+	size_t size;
+	const Texture_file_header *header;
+	const Texture_file_level *levels;
+};
+
+// Maps and validates the file
+bool texture_file_map(const std::string &path, Texture_file_map &m);
+void texture_file_unmap(Texture_file_map &m);
+
+// Warns once if the driver can't sample the stored format
+void texture_file_check_support(const Texture_file_map &m,
+		const std::string &path);
+
+// Level pixels / blocks with the requested orientation. Points into the
+// mapping, or into `tmp` when they had to be flipped.
+const unsigned char *texture_file_level_data(const Texture_file_map &m,
+		int level, bool verticalFlip, std::vector<unsigned char> &tmp);
+
+// Copies level pixels / blocks to `dst` (levels[level].size bytes), flipping
+// on the way if needed
+void texture_file_copy_level(const Texture_file_map &m, int level,
+		bool verticalFlip, unsigned char *dst);
+
+// Internal format for the levels, following the usage (see texture.hh)
+GLenum texture_file_internal_format(const Texture_file_header *h,
+		Texture_usage usage);
+size_t texture_file_level_bytes(const Texture_file_map &m, int level,
+		Texture_usage usage);
+
+// Uploads one level to the texture bound to GL_TEXTURE_2D. `immutable` if
+// its storage was allocated with glTexStorage2D.
+void texture_file_upload_level(const Texture_file_map &m, int level,
+		const unsigned char *data, GLenum internal_format, bool immutable);
+
+#endif
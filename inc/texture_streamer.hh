@@ -0,0 +1,118 @@
+#ifndef TEXTURE_STREAMER_HH
+#define TEXTURE_STREAMER_HH
+
+#include <texture.hh>
+#include <texture_cache.hh>
+#include <texture_file.hh>
+#include <upload_ring.hh>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+
+/**
+ * Streams the mip levels of baked (.ktex) textures under a GPU memory budget.
+ *
+ * load() maps the file and uploads only the small levels (up to
+ * `min_size` texels wide), so the texture can be sampled right away. Each
+ * frame the application reports how the texture is seen with use(), and
+ * update() works out the finest level worth having from the screen-space
+ * texel density, reads finer levels on a worker thread and uploads them one
+ * at a time, or drops levels again when the budget is exceeded. Textures
+ * that were not used for a while fall back to their small levels first.
+ *
+ * Resident levels are selected with GL_TEXTURE_BASE_LEVEL; dropped levels
+ * are respecified empty so the driver can release them. That needs mutable
+ * storage, so streamed textures never use glTexStorage2D.
+ *
+ * Paths that are not .ktex use the baked file next to them if there is one
+ * ("stones.jpg" -> "stones.ktex", see texbake), otherwise the image is loaded
+ * whole and stays resident.
+ *
+ * With an UploadRing workers copy levels from the file straight into a
+ * mapped pixel buffer and update() uploads from there, so a level costs the
+ * GL thread no copy.
+ */
+class TextureStreamer {
+public:
+	size_t streamed_in; // Levels uploaded by update()
+	size_t dropped;     // Levels released
+
+	TextureStreamer(size_t budget_bytes = 64 * 1024 * 1024,
+			int min_size = 64, unsigned int threads = 1,
+			UploadRing *ring = NULL);
+	~TextureStreamer();
+
+	Texture_handle load(const std::string &path, unsigned int location = 0,
+			bool verticalFlip = true, unsigned int wrapS = GL_REPEAT,
+			unsigned int wrapT = GL_REPEAT,
+			Texture_usage usage = TEXTURE_COLOR);
+
+	/**
+	 * Reports one draw with the texture this frame.
+	 *   uv_scale        - world units covered by one UV unit (Model::uv_scale)
+	 *   distance        - from the camera to the object
+	 *   pixels_per_unit - pixels covered by one world unit at distance 1,
+	 *                     projection[1][1] * viewport_height / 2
+	 */
+	void use(const Texture_handle &t, float uv_scale, float distance,
+			float pixels_per_unit);
+
+	// Once per frame on the GL thread. Uploads at most `budget_bytes`.
+	void update(size_t budget_bytes = 4 * 1024 * 1024);
+
+	void set_budget(size_t bytes) { budget_bytes = bytes; }
+	size_t budget(void) const { return budget_bytes; }
+	size_t resident_bytes(void) const;
+	void print_stats(std::ostream &out) const;
+
+private:
+	struct Entry {
+		Texture_handle texture;
+		Texture_file_map map;
+		bool flip;
+		GLenum internal_format;
+		int levels;
+		int min_level;  // Coarsest level kept resident, loaded up front
+		int top;        // Finest resident level
+		int target;     // Finest level we want resident
+		int wanted;     // Finest level asked for by use() this frame
+		int loading;    // Level being read by a worker, -1 if none
+		unsigned int last_used; // Frame
+		std::vector<size_t> bytes_from; // GPU bytes of levels i .. levels - 1
+	};
+
+	struct Job {
+		Entry *entry;
+		int level;
+		int slot; // In the upload ring, -1 if the level is in `data`
+		std::vector<unsigned char> data;
+	};
+
+	size_t budget_bytes;
+	int min_size;
+	unsigned int frame;
+	std::list<Entry> entries;
+	std::unordered_map<const Texture2D *, Entry *> by_texture;
+	std::vector<Texture_handle> pinned; // Not streamable, fully resident
+	UploadRing *ring;
+
+	std::vector<std::thread> workers;
+	std::deque<Job> queue; // Waiting to be read
+	std::deque<Job> done;  // Waiting to be uploaded (GL thread)
+	std::mutex mutex;
+	std::condition_variable work_cv;
+	bool quit;
+
+	void fit_budget(void);
+	void drop_levels(Entry &e, int level);
+	void upload_level(Entry &e, int level, const unsigned char *data);
+	void worker(void);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef UNIFORM_BUFFER_HH
+#define UNIFORM_BUFFER_HH
+
+#include <glad/glad.h>
+#include <cstddef>
+
+/**
+ * Uniform buffer object bound to a fixed binding point, shared by every
+ * shader whose block was attached to that point (Shader::bindBlock).
+ *
+ * The contents follow the std140 layout of the block: vec3 and array
+ * elements take 16 bytes, so C++ mirrors use glm::vec4 where the block has
+ * vec3 and pad scalars accordingly. Shader::blockSize() / offsetOf() report
+ * the layout the driver actually chose, to check the mirror against.
+ *
+ * GL_DYNAMIC_DRAW buffers are meant to be rewritten every frame: set() with
+ * the whole size orphans the old storage first, so the update never waits
+ * for draws still reading it. GL_STATIC_DRAW ones are written once.
+ */
+class UniformBuffer {
+public:
+	unsigned int ID;
+
+	UniformBuffer(size_t bytes, unsigned int binding,
+			GLenum usage = GL_DYNAMIC_DRAW, const void *data = NULL);
+	~UniformBuffer();
+
+	// Copies `bytes` to `offset` in the buffer
+	void set(const void *data, size_t bytes, size_t offset = 0);
+	template <typename T>
+	void set(const T &data) { set(&data, sizeof(T)); }
+
+	// Attaches the buffer to its binding point again
+	void bind(void) const;
+
+	unsigned int binding(void) const { return binding_point; }
+	size_t size(void) const { return bytes; }
+
+private:
+	size_t bytes;
+	unsigned int binding_point;
+	GLenum usage;
+
+	UniformBuffer(const UniformBuffer &);
+	UniformBuffer &operator=(const UniformBuffer &);
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef UPLOAD_RING_HH
+#define UPLOAD_RING_HH
+
+#include <glad/glad.h>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+/**
+ * Ring of pixel buffer objects for texture uploads off the GL thread.
+ *
+ * Worker threads grab a mapped slot with acquire() and write pixels straight
+ * into it. The GL thread binds the slot with bind(), so glTex(Sub)Image calls
+ * read from buffer offsets and return without copying, then hands it back
+ * with release(). A fence marks when the GPU is done reading, update() makes
+ * such slots available again.
+ *
+ * With GL 4.4 / ARB_buffer_storage the slots are mapped once, persistent and
+ * coherent. Otherwise each slot is mapped with glMapBufferRange while free
+ * and unmapped by bind(), so update() maps it again once its fence passed.
+ *
+ * acquire() never blocks: when every slot is busy (or the data doesn't fit
+ * in one) the caller uploads from client memory as before. Create the ring
+ * on the GL thread, after gl_ext_load(), and keep it alive longer than the
+ * loaders using it.
+ */
+class UploadRing {
+public:
+	size_t acquired; // Slots handed to workers
+	size_t missed;   // acquire() calls that found no slot
+
+	UploadRing(size_t slot_bytes = 8 * 1024 * 1024, unsigned int slots = 4);
+	~UploadRing();
+
+	bool persistent(void) const { return is_persistent; }
+	size_t slot_size(void) const { return slot_bytes; }
+
+	// Any thread. Returns a slot with `bytes` of writable memory, or -1.
+	int acquire(size_t bytes, unsigned char *&memory);
+
+	/**
+	 * GL thread. Binds the slot to GL_PIXEL_UNPACK_BUFFER and returns its
+	 * base "pointer": pixel data passed to glTex(Sub)Image is base + offset.
+	 * Call unbind() before uploading anything from client memory again.
+	 */
+	const unsigned char *bind(int slot);
+	void unbind(void);
+
+	// GL thread. The slot's uploads are issued (or it wasn't used at all)
+	void release(int slot);
+
+	// GL thread, once per frame. Recycles the slots the GPU is done with.
+	void update(void);
+
+private:
+	enum State {
+		SLOT_UNMAPPED, // Waiting for update() to map it
+		SLOT_FREE,     // Mapped, ready for acquire()
+		SLOT_WRITING,  // Owned by a worker, still mapped
+		SLOT_BOUND,    // Uploads being issued
+		SLOT_FENCED,   // Waiting for the GPU to read it
+	};
+
+	struct Slot {
+		GLuint buffer;
+		unsigned char *memory;
+		GLsync fence;
+		State state;
+	};
+
+	size_t slot_bytes;
+	bool is_persistent;
+	std::vector<Slot> slots;
+	std::mutex mutex;
+
+	void map(Slot &s);
+};
+
+#endif
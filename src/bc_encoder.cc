@@ -0,0 +1,270 @@
+#include <bc_encoder.hh>
+#include <gl_ext.hh>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+unsigned int bc_gl_format(Bc_format fmt) {
+	switch (fmt) {
+	case BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BC5: return GL_COMPRESSED_RG_RGTC2;
+	}
+	return 0;
+}
+
+size_t bc_block_bytes(Bc_format fmt) {
+	return fmt == BC1 ? 8 : 16;
+}
+
+size_t bc_image_bytes(Bc_format fmt, int width, int height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * bc_block_bytes(fmt);
+}
+
+static inline float clamp255(float v) {
+	return v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+}
+
+static inline unsigned short pack565(const float c[3]) {
+	int r = (int)(clamp255(c[0]) * (31.0f / 255.0f) + 0.5f);
+	int g = (int)(clamp255(c[1]) * (63.0f / 255.0f) + 0.5f);
+	int b = (int)(clamp255(c[2]) * (31.0f / 255.0f) + 0.5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+static inline void unpack565(unsigned short v, float c[3]) {
+	int r = (v >> 11) & 31;
+	int g = (v >> 5) & 63;
+	int b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+// Index of the closest palette entry for each of the 16 pixels, 2 bits each
+static uint32_t select_indices(const unsigned char *rgba, const float pal[4][3]) {
+	uint32_t bits = 0;
+#ifdef __SSE2__
+	for (int i = 0; i < 16; i += 4) {
+		const unsigned char *p = rgba + i * 4;
+		__m128 r = _mm_set_ps(p[12], p[8], p[4], p[0]);
+		__m128 g = _mm_set_ps(p[13], p[9], p[5], p[1]);
+		__m128 b = _mm_set_ps(p[14], p[10], p[6], p[2]);
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128i best_idx = _mm_setzero_si128();
+		for (int k = 0; k < 4; k++) {
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(pal[k][0]));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(pal[k][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(pal[k][2]));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr),
+						_mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i less = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(d, best);
+			best_idx = _mm_or_si128(_mm_andnot_si128(less, best_idx),
+					_mm_and_si128(less, _mm_set1_epi32(k)));
+		}
+		int32_t idx[4];
+		_mm_storeu_si128((__m128i *)idx, best_idx);
+		for (int k = 0; k < 4; k++)
+			bits |= (uint32_t)idx[k] << (2 * (i + k));
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		const unsigned char *p = rgba + i * 4;
+		float best = 1e30f;
+		int best_idx = 0;
+		for (int k = 0; k < 4; k++) {
+			float dr = p[0] - pal[k][0];
+			float dg = p[1] - pal[k][1];
+			float db = p[2] - pal[k][2];
+			float d = dr * dr + dg * dg + db * db;
+			if (d < best) {
+				best = d;
+				best_idx = k;
+			}
+		}
+		bits |= (uint32_t)best_idx << (2 * i);
+	}
+#endif
+	return bits;
+}
+
+void bc1_encode_block(const unsigned char *rgba, unsigned char *out) {
+	// Mean and covariance
+	float mean[3] = {0, 0, 0};
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += rgba[i * 4 + c];
+	for (int c = 0; c < 3; c++)
+		mean[c] /= 16.0f;
+
+	float cov[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++) {
+		float r = rgba[i * 4] - mean[0];
+		float g = rgba[i * 4 + 1] - mean[1];
+		float b = rgba[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// Principal axis by power iteration
+	float axis[3] = {1, 1, 1};
+	for (int it = 0; it < 8; it++) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+		if (len < 1e-6f)
+			break;
+		axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+	}
+	float len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	for (int c = 0; c < 3; c++)
+		axis[c] /= len;
+
+	// Extremes along the axis, inset a bit to reduce the error at the middle
+	float tmin = 1e30f, tmax = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = (rgba[i * 4] - mean[0]) * axis[0] +
+			(rgba[i * 4 + 1] - mean[1]) * axis[1] +
+			(rgba[i * 4 + 2] - mean[2]) * axis[2];
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+	float inset = (tmax - tmin) / 16.0f;
+	tmin += inset;
+	tmax -= inset;
+
+	float e0[3], e1[3];
+	for (int c = 0; c < 3; c++) {
+		e0[c] = mean[c] + axis[c] * tmax;
+		e1[c] = mean[c] + axis[c] * tmin;
+	}
+	unsigned short c0 = pack565(e0);
+	unsigned short c1 = pack565(e1);
+	if (c0 < c1) {
+		unsigned short tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+	}
+
+	uint32_t bits = 0;
+	if (c0 != c1) {
+		// Four color mode (c0 > c1)
+		float pal[4][3];
+		unpack565(c0, pal[0]);
+		unpack565(c1, pal[1]);
+		for (int c = 0; c < 3; c++) {
+			pal[2][c] = (2.0f * pal[0][c] + pal[1][c]) / 3.0f;
+			pal[3][c] = (pal[0][c] + 2.0f * pal[1][c]) / 3.0f;
+		}
+		bits = select_indices(rgba, pal);
+	}
+
+	out[0] = c0 & 0xFF;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF;
+	out[3] = c1 >> 8;
+	out[4] = bits & 0xFF;
+	out[5] = (bits >> 8) & 0xFF;
+	out[6] = (bits >> 16) & 0xFF;
+	out[7] = bits >> 24;
+}
+
+// Single channel block, 8 value mode (a0 > a1)
+static void bc4_encode_block(const unsigned char *rgba, int channel,
+		unsigned char *out) {
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++) {
+		int v = rgba[i * 4 + channel];
+		lo = std::min(lo, v);
+		hi = std::max(hi, v);
+	}
+	out[0] = hi;
+	out[1] = lo;
+
+	uint64_t bits = 0;
+	if (hi != lo) {
+		int range = hi - lo;
+		for (int i = 0; i < 16; i++) {
+			int v = rgba[i * 4 + channel];
+			// 0 = hi ... 7 = lo
+			int t = ((hi - v) * 7 + range / 2) / range;
+			uint64_t idx = t == 0 ? 0 : (t == 7 ? 1 : t + 1);
+			bits |= idx << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (bits >> (8 * i)) & 0xFF;
+}
+
+void bc3_encode_block(const unsigned char *rgba, unsigned char *out) {
+	bc4_encode_block(rgba, 3, out);
+	bc1_encode_block(rgba, out + 8);
+}
+
+void bc5_encode_block(const unsigned char *rgba, unsigned char *out) {
+	bc4_encode_block(rgba, 0, out);
+	bc4_encode_block(rgba, 1, out + 8);
+}
+
+static void fetch_block(const unsigned char *pixels, int width, int height,
+		int channels, int bx, int by, unsigned char *rgba) {
+	for (int y = 0; y < 4; y++) {
+		int sy = std::min(by * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++) {
+			int sx = std::min(bx * 4 + x, width - 1);
+			const unsigned char *p = pixels + ((size_t)sy * width + sx) * channels;
+			unsigned char *o = rgba + (y * 4 + x) * 4;
+			switch (channels) {
+			case 1: o[0] = o[1] = o[2] = p[0]; o[3] = 255; break;
+			case 2: o[0] = p[0]; o[1] = p[1]; o[2] = 0; o[3] = 255; break;
+			case 3: o[0] = p[0]; o[1] = p[1]; o[2] = p[2]; o[3] = 255; break;
+			default: memcpy(o, p, 4); break;
+			}
+		}
+	}
+}
+
+void bc_encode(Bc_format fmt, const unsigned char *pixels, int width,
+		int height, int channels, std::vector<unsigned char> &out,
+		unsigned int threads) {
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	size_t block = bc_block_bytes(fmt);
+	out.resize(bc_image_bytes(fmt, width, height));
+
+	void (*encode)(const unsigned char *, unsigned char *) =
+		fmt == BC1 ? bc1_encode_block :
+		fmt == BC3 ? bc3_encode_block : bc5_encode_block;
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > (unsigned int)blocks_y)
+		threads = blocks_y;
+
+	unsigned char *dst = out.data();
+	auto work = [=](unsigned int first) {
+		unsigned char rgba[64];
+		for (int by = first; by < blocks_y; by += threads) {
+			for (int bx = 0; bx < blocks_x; bx++) {
+				fetch_block(pixels, width, height, channels, bx, by, rgba);
+				encode(rgba, dst + ((size_t)by * blocks_x + bx) * block);
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++)
+		pool.push_back(std::thread(work, i));
+	work(0);
+	for (unsigned int i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
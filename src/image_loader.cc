@@ -0,0 +1,171 @@
+#include <image_loader.hh>
+#include <iostream>
+#include <cstring>
+
+ImageLoader::ImageLoader(unsigned int threads, UploadRing *ring) : ring(ring),
+		decoding(0), quit(false) {
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	for (unsigned int i=0; i<threads; i++)
+		workers.push_back(std::thread(&ImageLoader::worker, this));
+}
+
+ImageLoader::~ImageLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	work_cv.notify_all();
+	for (unsigned int i=0; i<workers.size(); i++)
+		workers[i].join();
+}
+
+Texture_handle ImageLoader::load(const std::string &path,
+		unsigned int location, bool verticalFlip, unsigned int wrapS,
+		unsigned int wrapT, Texture_usage usage) {
+	Job j;
+	j.path = path;
+	j.flip = verticalFlip;
+	j.usage = usage;
+	j.texture = make_texture_handle(new Texture2D(location, wrapS, wrapT, usage));
+	j.slot = -1;
+	j.ok = false;
+	j.next_row = 0;
+	Texture_handle t = j.texture;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(j);
+	}
+	work_cv.notify_one();
+	return t;
+}
+
+int ImageLoader::upload(size_t budget_bytes) {
+	int completed = 0;
+	size_t sent = 0;
+	if (ring)
+		ring->update();
+	while (sent < budget_bytes) {
+		Job *j;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (decoded.empty())
+				break;
+			j = &decoded.front();
+		}
+
+		if (!j->ok) {
+			std::cout << "Failed to load texture " << j->path << std::endl;
+		}
+		else {
+			Image &img = j->image;
+			if (j->next_row == 0)
+				j->texture->allocate(img.width, img.height, img.channels);
+			const unsigned char *pixels = j->slot >= 0 ?
+				ring->bind(j->slot) : img.pixels.get();
+
+			// Upload at least one row so we always make progress
+			size_t row = img.row_bytes();
+			size_t fit = (budget_bytes - sent) / row;
+			int rows = img.height - j->next_row;
+			if (fit < (size_t)rows)
+				rows = fit > 0 ? fit : 1;
+			j->texture->upload_rows(pixels + j->next_row * row, j->next_row,
+					rows);
+			j->next_row += rows;
+			sent += rows * row;
+			if (j->next_row < img.height) {
+				if (j->slot >= 0)
+					ring->unbind();
+				continue;
+			}
+			if (j->mips.empty())
+				j->texture->finish_upload();
+			else if (j->slot >= 0)
+				j->texture->upload_mips(j->mips, pixels + img.height * row);
+			else
+				j->texture->upload_mips(j->mips);
+			if (j->slot >= 0) {
+				ring->unbind();
+				ring->release(j->slot);
+			}
+			completed++;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.pop_front();
+	}
+	return completed;
+}
+
+void ImageLoader::finish(void) {
+	while (pending()) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done_cv.wait(lock, [this] {
+				return !decoded.empty() || (queue.empty() && decoding == 0);
+			});
+		}
+		upload((size_t)-1);
+	}
+}
+
+size_t ImageLoader::pending(void) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return queue.size() + decoding + decoded.size();
+}
+
+// private
+void ImageLoader::worker(void) {
+	for (;;) {
+		Job j;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_cv.wait(lock, [this] { return quit || !queue.empty(); });
+			if (quit)
+				return;
+			j = queue.front();
+			queue.pop_front();
+			decoding++;
+		}
+
+		j.ok = load_image(j.path, j.flip, j.image);
+		// One thread per image, the workers already run in parallel
+		if (j.ok && Texture2D::mip_filter != MIP_DRIVER)
+			mip_generate(j.image.pixels.get(), j.image.width, j.image.height,
+					j.image.channels, j.mips, Texture2D::mip_filter, j.usage, 1);
+		if (j.ok && ring)
+			copy_to_ring(j);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(j);
+			decoding--;
+		}
+		done_cv.notify_all();
+	}
+}
+
+// Moves the image and its mips into an upload slot, if one is free
+void ImageLoader::copy_to_ring(Job &j) {
+	size_t bytes = j.image.row_bytes() * j.image.height;
+	size_t total = bytes;
+	for (unsigned int i = 0; i < j.mips.size(); i++)
+		total += j.mips[i].pixels.size();
+
+	unsigned char *dst;
+	j.slot = ring->acquire(total, dst);
+	if (j.slot < 0)
+		return;
+	memcpy(dst, j.image.pixels.get(), bytes);
+	j.image.pixels.reset();
+	dst += bytes;
+	for (unsigned int i = 0; i < j.mips.size(); i++) {
+		std::vector<unsigned char> &p = j.mips[i].pixels;
+		memcpy(dst, p.data(), p.size());
+		dst += p.size();
+		std::vector<unsigned char>().swap(p);
+	}
+}
@@ -0,0 +1,248 @@
+#include <light_clusters.hh>
+#include <gl_state.hh>
+#include <algorithm>
+#include <cmath>
+
+// Smallest size of a buffer, texture buffers of 0 bytes are not complete
+#define CLUSTERS_MIN_BYTES 64
+
+static const GLenum buffer_formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+LightClusters::LightClusters(int width, int height, int tile_size, int slices,
+		unsigned int threads) : size(tile_size), depth_slices(slices),
+		scale(0.0f), bias(0.0f), total(0), job_lights(NULL), generation(0),
+		running(0), quit(false) {
+	resize(width, height);
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, CLUSTERS_MIN_BYTES, NULL,
+				GL_STREAM_DRAW);
+		capacity[i] = CLUSTERS_MIN_BYTES;
+		gl_bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, buffer_formats[i], buffers[i]);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > (unsigned int)slices)
+		threads = slices;
+	chunks.resize(threads);
+	// The calling thread bins chunk 0
+	for (unsigned int i = 1; i < threads; i++)
+		workers.push_back(std::thread(&LightClusters::worker, this, i));
+}
+
+LightClusters::~LightClusters() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	work_cv.notify_all();
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+	gl_delete_textures(3, textures);
+	glDeleteBuffers(3, buffers);
+}
+
+void LightClusters::resize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	columns = (width + size - 1) / size;
+	rows = (height + size - 1) / size;
+}
+
+void LightClusters::bin(const std::vector<Tile_light> &lights,
+		const glm::mat4 &projection) {
+	float near = projection[3][2] / (projection[2][2] - 1.0f);
+	float far = projection[3][2] / (projection[2][2] + 1.0f);
+	sx = projection[0][0];
+	sy = projection[1][1];
+	scale = depth_slices / logf(far / near);
+	bias = -logf(near) * scale;
+	slice_depth.resize(depth_slices + 1);
+	for (int s = 0; s <= depth_slices; s++)
+		slice_depth[s] = near * powf(far / near, (float)s / depth_slices);
+
+	unsigned int n = lights.size();
+	first_slice.resize(n);
+	last_slice.resize(n);
+	for (unsigned int l = 0; l < n; l++) {
+		const glm::vec4 &p = lights[l].position;
+		float zn = -(p.z + p.w), zf = -(p.z - p.w);
+		if (zf < near || zn > far) {
+			first_slice[l] = 1;
+			last_slice[l] = 0;
+			continue;
+		}
+		int first = (int)(logf(std::max(zn, near)) * scale + bias);
+		int last = (int)(logf(std::min(zf, far)) * scale + bias);
+		first_slice[l] = std::max(first, 0);
+		last_slice[l] = std::min(last, depth_slices - 1);
+	}
+
+	clusters.assign(columns * rows * depth_slices * 2, 0);
+	job_lights = &lights;
+	if (!workers.empty()) {
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+		running = workers.size();
+	}
+	work_cv.notify_all();
+	bin_chunk(0);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [this] { return running == 0; });
+	}
+	job_lights = NULL;
+
+	// Chunks were numbered from 0 each, put them one after the other
+	total = 0;
+	for (unsigned int i = 0; i < chunks.size(); i++) {
+		chunks[i].base = total;
+		total += chunks[i].indices.size();
+	}
+	int per_slice = columns * rows;
+	for (int s = 0; s < depth_slices; s++) {
+		GLuint base = chunks[s % chunks.size()].base;
+		for (int c = s * per_slice; c < (s + 1) * per_slice; c++)
+			clusters[c * 2] += base;
+	}
+}
+
+void LightClusters::upload(const std::vector<Tile_light> &lights) {
+	size_t bytes = lights.size() * sizeof(Tile_light);
+	reserve(0, bytes);
+	if (bytes)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, lights.data());
+	reserve(1, clusters.size() * sizeof(GLuint));
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, clusters.size() * sizeof(GLuint),
+			clusters.data());
+	// Each chunk straight from its thread's list
+	reserve(2, total * sizeof(GLuint));
+	for (unsigned int i = 0; i < chunks.size(); i++)
+		if (!chunks[i].indices.empty())
+			glBufferSubData(GL_TEXTURE_BUFFER,
+					chunks[i].base * sizeof(GLuint),
+					chunks[i].indices.size() * sizeof(GLuint),
+					chunks[i].indices.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind(unsigned int first_unit) const {
+	for (int i = 0; i < 3; i++) {
+		gl_active_texture(GL_TEXTURE0 + first_unit + i);
+		gl_bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+	}
+}
+
+float LightClusters::average_per_cluster(void) const {
+	return clusters.empty() ? 0.0f : (float)total / (clusters.size() / 2);
+}
+
+int LightClusters::max_per_cluster(void) const {
+	GLuint m = 0;
+	for (unsigned int c = 1; c < clusters.size(); c += 2)
+		m = std::max(m, clusters[c]);
+	return m;
+}
+
+// private
+
+void LightClusters::worker(unsigned int i) {
+	unsigned int seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		work_cv.wait(lock, [&] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+		lock.unlock();
+		bin_chunk(i);
+		lock.lock();
+		if (--running == 0)
+			done_cv.notify_one();
+	}
+}
+
+/*
+ * Lists of the clusters in slices i, i + threads, ... Every light is clipped
+ * to each of these slices it crosses, and its rectangle kept for the second
+ * pass: count, offsets (from 0 in this chunk), then fill.
+ */
+void LightClusters::bin_chunk(unsigned int i) {
+	const std::vector<Tile_light> &lights = *job_lights;
+	unsigned int threads = chunks.size();
+	Chunk &chunk = chunks[i];
+	chunk.rects.clear();
+	float hx = width * 0.5f / size, hy = height * 0.5f / size;
+
+	for (unsigned int l = 0; l < lights.size(); l++) {
+		const glm::vec4 &p = lights[l].position;
+		float cz = -p.z, r2 = p.w * p.w;
+		int first = first_slice[l];
+		for (int s = first + (i + threads - first % threads) % threads;
+				s <= last_slice[l]; s += threads) {
+			// Depths of the sphere inside the slice, and the radius of its
+			// widest section there
+			float a = std::max(cz - p.w, slice_depth[s]);
+			float b = std::min(cz + p.w, slice_depth[s + 1]);
+			if (a > b)
+				continue;
+			float d = cz < a ? a - cz : cz > b ? cz - b : 0.0f;
+			float r = sqrtf(std::max(r2 - d * d, 0.0f));
+
+			float ax = p.x - r, bx = p.x + r, ay = p.y - r, by = p.y + r;
+			float fx0 = sx * std::min(ax / a, ax / b) * hx + hx;
+			float fx1 = sx * std::max(bx / a, bx / b) * hx + hx;
+			float fy0 = sy * std::min(ay / a, ay / b) * hy + hy;
+			float fy1 = sy * std::max(by / a, by / b) * hy + hy;
+			if (fx1 < 0.0f || fy1 < 0.0f || fx0 >= columns || fy0 >= rows)
+				continue;
+			int x0 = std::max((int)fx0, 0), y0 = std::max((int)fy0, 0);
+			int x1 = std::min((int)fx1, columns - 1);
+			int y1 = std::min((int)fy1, rows - 1);
+
+			int corner = (s * rows + y0) * columns + x0;
+			chunk.rects.push_back(l);
+			chunk.rects.push_back(corner);
+			chunk.rects.push_back(x1 - x0);
+			chunk.rects.push_back(y1 - y0);
+			for (int y = 0; y <= y1 - y0; y++)
+				for (int x = 0; x <= x1 - x0; x++)
+					clusters[(corner + y * columns + x) * 2 + 1]++;
+		}
+	}
+
+	int per_slice = columns * rows;
+	GLuint offset = 0;
+	for (int s = i; s < depth_slices; s += threads)
+		for (int c = s * per_slice; c < (s + 1) * per_slice; c++) {
+			clusters[c * 2] = offset;
+			offset += clusters[c * 2 + 1];
+			clusters[c * 2 + 1] = 0;
+		}
+
+	chunk.indices.resize(offset);
+	for (unsigned int k = 0; k < chunk.rects.size(); k += 4) {
+		GLuint l = chunk.rects[k];
+		int corner = chunk.rects[k + 1];
+		for (int y = 0; y <= chunk.rects[k + 3]; y++)
+			for (int x = 0; x <= chunk.rects[k + 2]; x++) {
+				GLuint *cluster = &clusters[(corner + y * columns + x) * 2];
+				chunk.indices[cluster[0] + cluster[1]++] = l;
+			}
+	}
+}
+
+// Orphans buffer i with room for `bytes`, and leaves it bound
+void LightClusters::reserve(int i, size_t bytes) {
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+	if (bytes > capacity[i])
+		capacity[i] = bytes + bytes / 2;
+	glBufferData(GL_TEXTURE_BUFFER, capacity[i], NULL, GL_STREAM_DRAW);
+}
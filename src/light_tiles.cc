@@ -0,0 +1,229 @@
+#include <light_tiles.hh>
+#include <gl_state.hh>
+#include <algorithm>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TILES_X86
+#include <immintrin.h>
+#endif
+
+// Smallest size of a buffer, texture buffers of 0 bytes are not complete
+#define TILES_MIN_BYTES 64
+
+static const GLenum buffer_formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+LightTiles::LightTiles(int width, int height, int tile_size) : size(tile_size) {
+	resize(width, height);
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, TILES_MIN_BYTES, NULL, GL_STREAM_DRAW);
+		capacity[i] = TILES_MIN_BYTES;
+		gl_bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, buffer_formats[i], buffers[i]);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+LightTiles::~LightTiles() {
+	gl_delete_textures(3, textures);
+	glDeleteBuffers(3, buffers);
+}
+
+void LightTiles::resize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	columns = (width + size - 1) / size;
+	rows = (height + size - 1) / size;
+}
+
+void LightTiles::bin(const std::vector<Tile_light> &lights,
+		const glm::mat4 &projection) {
+	light_rects(lights, projection);
+
+	// Count the lights of each tile, turn the counts into offsets, then
+	// fill the lists
+	int n = columns * rows;
+	tiles.assign(n * 2, 0);
+	for (unsigned int l = 0; l < lights.size(); l++)
+		for (int y = y0[l]; y <= y1[l]; y++)
+			for (int x = x0[l]; x <= x1[l]; x++)
+				tiles[(y * columns + x) * 2 + 1]++;
+	GLuint total = 0;
+	for (int t = 0; t < n; t++) {
+		tiles[t * 2] = total;
+		total += tiles[t * 2 + 1];
+		tiles[t * 2 + 1] = 0;
+	}
+	indices.resize(total);
+	for (unsigned int l = 0; l < lights.size(); l++)
+		for (int y = y0[l]; y <= y1[l]; y++)
+			for (int x = x0[l]; x <= x1[l]; x++) {
+				GLuint *tile = &tiles[(y * columns + x) * 2];
+				indices[tile[0] + tile[1]++] = l;
+			}
+}
+
+void LightTiles::upload(const std::vector<Tile_light> &lights) {
+	send(0, lights.data(), lights.size() * sizeof(Tile_light));
+	send(1, tiles.data(), tiles.size() * sizeof(GLuint));
+	send(2, indices.data(), indices.size() * sizeof(GLuint));
+}
+
+void LightTiles::bind(unsigned int first_unit) const {
+	for (int i = 0; i < 3; i++) {
+		gl_active_texture(GL_TEXTURE0 + first_unit + i);
+		gl_bind_texture(GL_TEXTURE_BUFFER, textures[i]);
+	}
+}
+
+float LightTiles::average_per_tile(void) const {
+	return tiles.empty() ? 0.0f : (float)indices.size() / (tiles.size() / 2);
+}
+
+int LightTiles::max_per_tile(void) const {
+	GLuint m = 0;
+	for (unsigned int t = 1; t < tiles.size(); t += 2)
+		m = std::max(m, tiles[t]);
+	return m;
+}
+
+// private
+
+/*
+ * Screen bounds of one sphere, in tiles. Eye space looks down -z: the
+ * sphere spans depths zn .. zf in front of the camera, and its x extent
+ * projects widest at one of the two.
+ */
+struct Tile_params {
+	float sx, sy;   // projection[0][0], projection[1][1]
+	float near;
+	float hx, hy;   // Half the screen, in tiles
+	int columns, rows;
+};
+
+static void light_rect(const glm::vec4 &p, const Tile_params &t, int &x0,
+		int &x1, int &y0, int &y1) {
+	float zn = -(p.z + p.w), zf = -(p.z - p.w);
+	x0 = y0 = 0;
+	x1 = t.columns - 1;
+	y1 = t.rows - 1;
+	if (zf < t.near) {
+		x1 = -1;
+		return;
+	}
+	if (zn < t.near)
+		return;
+	float ax = p.x - p.w, bx = p.x + p.w, ay = p.y - p.w, by = p.y + p.w;
+	float fx0 = t.sx * std::min(ax / zn, ax / zf) * t.hx + t.hx;
+	float fx1 = t.sx * std::max(bx / zn, bx / zf) * t.hx + t.hx;
+	float fy0 = t.sy * std::min(ay / zn, ay / zf) * t.hy + t.hy;
+	float fy1 = t.sy * std::max(by / zn, by / zf) * t.hy + t.hy;
+	if (fx1 < 0.0f || fy1 < 0.0f || fx0 >= t.columns || fy0 >= t.rows) {
+		x1 = -1;
+		return;
+	}
+	x0 = std::max((int)fx0, 0);
+	y0 = std::max((int)fy0, 0);
+	x1 = std::min((int)fx1, t.columns - 1);
+	y1 = std::min((int)fy1, t.rows - 1);
+}
+
+#if defined(TILES_X86) && defined(__SSE2__)
+// Same as light_rect() for 4 lights, `p` must hold 4 of them
+static void light_rects_sse2(const glm::vec4 *p, const Tile_params &t,
+		int *x0, int *x1, int *y0, int *y1) {
+	__m128 x = _mm_loadu_ps(&p[0].x), y = _mm_loadu_ps(&p[1].x);
+	__m128 z = _mm_loadu_ps(&p[2].x), r = _mm_loadu_ps(&p[3].x);
+	_MM_TRANSPOSE4_PS(x, y, z, r);
+
+	__m128 near = _mm_set1_ps(t.near);
+	__m128 zn = _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), z), r);
+	__m128 zf = _mm_sub_ps(r, z);
+	__m128 behind = _mm_cmplt_ps(zf, near);
+	__m128 crossing = _mm_cmplt_ps(zn, near);
+	// Keeps the divisions finite, those lanes are replaced below
+	zn = _mm_max_ps(zn, near);
+	zf = _mm_max_ps(zf, near);
+
+	__m128 hx = _mm_set1_ps(t.hx), hy = _mm_set1_ps(t.hy);
+	__m128 sx = _mm_mul_ps(_mm_set1_ps(t.sx), hx);
+	__m128 sy = _mm_mul_ps(_mm_set1_ps(t.sy), hy);
+	__m128 ax = _mm_sub_ps(x, r), bx = _mm_add_ps(x, r);
+	__m128 ay = _mm_sub_ps(y, r), by = _mm_add_ps(y, r);
+	__m128 fx0 = _mm_add_ps(_mm_mul_ps(sx, _mm_min_ps(_mm_div_ps(ax, zn),
+					_mm_div_ps(ax, zf))), hx);
+	__m128 fx1 = _mm_add_ps(_mm_mul_ps(sx, _mm_max_ps(_mm_div_ps(bx, zn),
+					_mm_div_ps(bx, zf))), hx);
+	__m128 fy0 = _mm_add_ps(_mm_mul_ps(sy, _mm_min_ps(_mm_div_ps(ay, zn),
+					_mm_div_ps(ay, zf))), hy);
+	__m128 fy1 = _mm_add_ps(_mm_mul_ps(sy, _mm_max_ps(_mm_div_ps(by, zn),
+					_mm_div_ps(by, zf))), hy);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 last_x = _mm_set1_ps((float)(t.columns - 1));
+	__m128 last_y = _mm_set1_ps((float)(t.rows - 1));
+	__m128 off = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(fx1, zero),
+				_mm_cmplt_ps(fy1, zero)), _mm_or_ps(
+				_mm_cmpge_ps(fx0, _mm_set1_ps((float)t.columns)),
+				_mm_cmpge_ps(fy0, _mm_set1_ps((float)t.rows))));
+	off = _mm_or_ps(_mm_andnot_ps(crossing, off), behind);
+
+	// Lights crossing the near plane take the whole screen
+	fx0 = _mm_andnot_ps(crossing, _mm_max_ps(fx0, zero));
+	fy0 = _mm_andnot_ps(crossing, _mm_max_ps(fy0, zero));
+	fx1 = _mm_or_ps(_mm_and_ps(crossing, last_x),
+			_mm_andnot_ps(crossing, _mm_min_ps(fx1, last_x)));
+	fy1 = _mm_or_ps(_mm_and_ps(crossing, last_y),
+			_mm_andnot_ps(crossing, _mm_min_ps(fy1, last_y)));
+
+	// Off screen: x1 = -1, every bit set
+	__m128i off_i = _mm_castps_si128(off);
+	_mm_storeu_si128((__m128i *)x0, _mm_andnot_si128(off_i,
+				_mm_cvttps_epi32(fx0)));
+	_mm_storeu_si128((__m128i *)x1, _mm_or_si128(off_i,
+				_mm_cvttps_epi32(fx1)));
+	_mm_storeu_si128((__m128i *)y0, _mm_cvttps_epi32(fy0));
+	_mm_storeu_si128((__m128i *)y1, _mm_cvttps_epi32(fy1));
+}
+#endif
+
+void LightTiles::light_rects(const std::vector<Tile_light> &lights,
+		const glm::mat4 &projection) {
+	Tile_params t;
+	t.sx = projection[0][0];
+	t.sy = projection[1][1];
+	t.near = projection[3][2] / (projection[2][2] - 1.0f);
+	t.hx = width * 0.5f / size;
+	t.hy = height * 0.5f / size;
+	t.columns = columns;
+	t.rows = rows;
+
+	unsigned int n = lights.size();
+	x0.resize(n);
+	x1.resize(n);
+	y0.resize(n);
+	y1.resize(n);
+	unsigned int i = 0;
+#if defined(TILES_X86) && defined(__SSE2__)
+	for (; i + 4 <= n; i += 4) {
+		glm::vec4 p[4];
+		for (int k = 0; k < 4; k++)
+			p[k] = lights[i + k].position;
+		light_rects_sse2(p, t, &x0[i], &x1[i], &y0[i], &y1[i]);
+	}
+#endif
+	for (; i < n; i++)
+		light_rect(lights[i].position, t, x0[i], x1[i], y0[i], y1[i]);
+}
+
+// Orphans the buffer, so the upload never waits for the last frame
+void LightTiles::send(int i, const void *data, size_t bytes) {
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+	if (bytes > capacity[i])
+		capacity[i] = bytes + bytes / 2;
+	glBufferData(GL_TEXTURE_BUFFER, capacity[i], NULL, GL_STREAM_DRAW);
+	if (bytes)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -1,14 +1,13 @@
 #include <mesh.hh>
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
+#include <gl_state.hh>
+#include <cmath>
 
 void Mesh::setup_gpu(void) {
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	glBindVertexArray(VAO);
+	gl_bind_vertex_array(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
@@ -36,14 +35,34 @@ void Mesh::setup_gpu(void) {
 }
 
 void Mesh::draw(void) {
-	glBindVertexArray(VAO);
+	gl_bind_vertex_array(VAO);
+	// Attribute 3 is not enabled, every vertex reads this value
+	glVertexAttribI1ui(3, material);
 	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 }
 
+void Mesh::uv_area(float &area, float &uv) const {
+	area = uv = 0.0f;
+	for (unsigned int i=0; i+2<indices.size(); i+=3) {
+		const Vertex &a = vertices[indices[i]];
+		const Vertex &b = vertices[indices[i + 1]];
+		const Vertex &c = vertices[indices[i + 2]];
+		glm::vec3 p0(a.position.x, a.position.y, a.position.z);
+		glm::vec3 p1(b.position.x, b.position.y, b.position.z);
+		glm::vec3 p2(c.position.x, c.position.y, c.position.z);
+		area += 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+		float u1 = b.tex_coords.x - a.tex_coords.x;
+		float v1 = b.tex_coords.y - a.tex_coords.y;
+		float u2 = c.tex_coords.x - a.tex_coords.x;
+		float v2 = c.tex_coords.y - a.tex_coords.y;
+		uv += 0.5f * std::fabs(u1 * v2 - u2 * v1);
+	}
+}
+
 void Mesh::free_gpu() {
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &EBO);
-	glDeleteVertexArrays(1, &VAO);
+	gl_delete_vertex_arrays(1, &VAO);
 	did_setup = false;
 }
 
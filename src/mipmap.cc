@@ -0,0 +1,343 @@
+#include <mipmap.hh>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MIP_X86
+#include <immintrin.h>
+#endif
+
+// Rows below this are not worth a thread
+#define MIP_MIN_ROWS 32
+// Entries of the linear -> sRGB table
+#define MIP_SRGB_STEPS 16384
+
+struct Float_image {
+	int width, height, channels;
+	std::vector<float> pixels;
+};
+
+struct Srgb_tables {
+	float to_linear[256];
+	unsigned char to_srgb[MIP_SRGB_STEPS];
+
+	Srgb_tables() {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			to_linear[i] = c <= 0.04045f ? c / 12.92f :
+				std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < MIP_SRGB_STEPS; i++) {
+			float l = (float)i / (MIP_SRGB_STEPS - 1);
+			float c = l <= 0.0031308f ? l * 12.92f :
+				1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = (unsigned char)(c * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const Srgb_tables &srgb_tables(void) {
+	static Srgb_tables tables;
+	return tables;
+}
+
+// Channels stored gamma encoded: color, but never alpha
+static bool is_gamma(int c, int channels, Texture_usage usage) {
+	if (usage != TEXTURE_COLOR && usage != TEXTURE_COLOR_SRGB)
+		return false;
+	if (channels == 2)
+		return c == 0;
+	return c < 3;
+}
+
+static void parallel_rows(int rows, unsigned int threads,
+		const std::function<void(int, int)> &work) {
+	unsigned int max_threads = (rows + MIP_MIN_ROWS - 1) / MIP_MIN_ROWS;
+	if (threads > max_threads)
+		threads = max_threads;
+	if (threads <= 1) {
+		work(0, rows);
+		return;
+	}
+	std::vector<std::thread> pool;
+	int per = (rows + threads - 1) / threads;
+	for (unsigned int i = 1; i < threads; i++) {
+		int first = i * per;
+		if (first < rows)
+			pool.push_back(std::thread(work, first, std::min(rows, first + per)));
+	}
+	work(0, std::min(rows, per));
+	for (unsigned int i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
+
+/*
+ * Vertical pass: dst[i] = sum of w[k] * rows[k][i]. Rows are contiguous so
+ * this is where the SIMD goes.
+ */
+typedef void (*Rows_kernel)(float *dst, const float *const *rows,
+		const float *w, int taps, int n);
+
+static void rows_scalar(float *dst, const float *const *rows, const float *w,
+		int taps, int n) {
+	for (int i = 0; i < n; i++) {
+		float s = 0.0f;
+		for (int k = 0; k < taps; k++)
+			s += w[k] * rows[k][i];
+		dst[i] = s;
+	}
+}
+
+#if defined(MIP_X86) && defined(__SSE2__)
+static void rows_sse2(float *dst, const float *const *rows, const float *w,
+		int taps, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 s = _mm_setzero_ps();
+		for (int k = 0; k < taps; k++)
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(w[k]),
+						_mm_loadu_ps(rows[k] + i)));
+		_mm_storeu_ps(dst + i, s);
+	}
+	const float *tail[8];
+	for (int k = 0; k < taps; k++)
+		tail[k] = rows[k] + i;
+	rows_scalar(dst + i, tail, w, taps, n - i);
+}
+#endif
+
+#ifdef MIP_X86
+__attribute__((target("avx2")))
+static void rows_avx2(float *dst, const float *const *rows, const float *w,
+		int taps, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 s = _mm256_setzero_ps();
+		for (int k = 0; k < taps; k++)
+			s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_set1_ps(w[k]),
+						_mm256_loadu_ps(rows[k] + i)));
+		_mm256_storeu_ps(dst + i, s);
+	}
+	const float *tail[8];
+	for (int k = 0; k < taps; k++)
+		tail[k] = rows[k] + i;
+	rows_scalar(dst + i, tail, w, taps, n - i);
+}
+#endif
+
+static Rows_kernel rows_kernel(void) {
+#ifdef MIP_X86
+	if (__builtin_cpu_supports("avx2"))
+		return rows_avx2;
+#endif
+#if defined(MIP_X86) && defined(__SSE2__)
+	return rows_sse2;
+#else
+	return rows_scalar;
+#endif
+}
+
+const char *mip_isa(void) {
+	Rows_kernel k = rows_kernel();
+#ifdef MIP_X86
+	if (k == rows_avx2)
+		return "avx2";
+#endif
+	return k == rows_scalar ? "scalar" : "sse2";
+}
+
+/*
+ * Horizontal pass over one row, from `src` (src_width pixels) to `dst`.
+ * Taps start at 2x + first, clamped to the row.
+ */
+static void filter_row(float *dst, int dst_width, const float *src,
+		int src_width, int channels, const float *w, int taps, int first) {
+	// Pixels whose taps are all inside the row skip the clamping: x from
+	// ceil(-first / 2) to floor((src_width - taps - first) / 2). The last
+	// one is negative for rows narrower than the taps, / would round it up.
+	int inner0 = (-first + 1) / 2;
+	int last = src_width - taps - first;
+	int inner1 = (last >= 0 ? last / 2 : -((1 - last) / 2)) + 1;
+	inner1 = std::min(std::max(inner1, inner0), dst_width);
+	for (int x = 0; x < dst_width; x++) {
+		int x0 = 2 * x + first;
+		bool clamp = x < inner0 || x >= inner1;
+#if defined(MIP_X86) && defined(__SSE2__)
+		if (channels == 4) {
+			__m128 s = _mm_setzero_ps();
+			for (int k = 0; k < taps; k++) {
+				int sx = clamp ? std::min(std::max(x0 + k, 0), src_width - 1) :
+					x0 + k;
+				s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(w[k]),
+							_mm_loadu_ps(src + sx * 4)));
+			}
+			_mm_storeu_ps(dst + x * 4, s);
+			continue;
+		}
+#endif
+		float s[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+		for (int k = 0; k < taps; k++) {
+			int sx = clamp ? std::min(std::max(x0 + k, 0), src_width - 1) :
+				x0 + k;
+			const float *p = src + sx * channels;
+			for (int c = 0; c < channels; c++)
+				s[c] += w[k] * p[c];
+		}
+		for (int c = 0; c < channels; c++)
+			dst[x * channels + c] = s[c];
+	}
+}
+
+static double bessel_i0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/*
+ * Weights for halving. Box: 2 taps starting at 2x. Kaiser: 8 taps starting
+ * at 2x - 3, sinc at half the source rate, window radius 4 source texels.
+ */
+static int filter_weights(Mip_filter filter, float *w, int &first) {
+	if (filter != MIP_KAISER) {
+		w[0] = w[1] = 0.5f;
+		first = 0;
+		return 2;
+	}
+	const double alpha = 4.0, pi = 3.14159265358979323846;
+	double sum = 0.0, wd[8];
+	for (int k = 0; k < 8; k++) {
+		double t = k - 3.5; // From the destination texel center
+		double x = t / 2.0;
+		double sinc = std::sin(pi * x) / (pi * x);
+		double r = t / 4.0;
+		wd[k] = sinc * bessel_i0(alpha * std::sqrt(1.0 - r * r)) /
+			bessel_i0(alpha);
+		sum += wd[k];
+	}
+	for (int k = 0; k < 8; k++)
+		w[k] = wd[k] / sum;
+	first = -3;
+	return 8;
+}
+
+static void downsample(const Float_image &src, Float_image &dst,
+		Mip_filter filter, unsigned int threads) {
+	dst.width = src.width > 1 ? src.width / 2 : 1;
+	dst.height = src.height > 1 ? src.height / 2 : 1;
+	dst.channels = src.channels;
+	dst.pixels.resize((size_t)dst.width * dst.height * dst.channels);
+
+	float w[8];
+	int first;
+	int taps = filter_weights(filter, w, first);
+	Rows_kernel kernel = rows_kernel();
+	size_t src_row = (size_t)src.width * src.channels;
+	size_t dst_row = (size_t)dst.width * dst.channels;
+
+	parallel_rows(dst.height, threads, [&](int y0, int y1) {
+		std::vector<float> tmp(src_row);
+		const float *rows[8];
+		for (int y = y0; y < y1; y++) {
+			for (int k = 0; k < taps; k++) {
+				int sy = std::min(std::max(2 * y + first + k, 0), src.height - 1);
+				rows[k] = src.pixels.data() + sy * src_row;
+			}
+			kernel(tmp.data(), rows, w, taps, src_row);
+			filter_row(dst.pixels.data() + y * dst_row, dst.width, tmp.data(),
+					src.width, src.channels, w, taps, first);
+		}
+	});
+}
+
+static void decode(const unsigned char *pixels, int width, int height,
+		int channels, Texture_usage usage, Float_image &out,
+		unsigned int threads) {
+	const Srgb_tables &t = srgb_tables();
+	bool gamma[4];
+	for (int c = 0; c < channels; c++)
+		gamma[c] = is_gamma(c, channels, usage);
+	out.width = width;
+	out.height = height;
+	out.channels = channels;
+	out.pixels.resize((size_t)width * height * channels);
+	parallel_rows(height, threads, [&](int y0, int y1) {
+		const unsigned char *p = pixels + (size_t)y0 * width * channels;
+		float *o = out.pixels.data() + (size_t)y0 * width * channels;
+		for (size_t i = 0; i < (size_t)(y1 - y0) * width; i++)
+			for (int c = 0; c < channels; c++, p++, o++)
+				*o = gamma[c] ? t.to_linear[*p] : *p * (1.0f / 255.0f);
+	});
+}
+
+// Clamps away Kaiser ringing and renormalizes normals, in place
+static void fix_up(Float_image &img, Texture_usage usage, unsigned int threads) {
+	int ch = img.channels;
+	parallel_rows(img.height, threads, [&](int y0, int y1) {
+		for (int y = y0; y < y1; y++) {
+			float *p = img.pixels.data() + (size_t)y * img.width * ch;
+			for (int x = 0; x < img.width; x++, p += ch) {
+				for (int c = 0; c < ch; c++)
+					p[c] = std::min(std::max(p[c], 0.0f), 1.0f);
+				if (usage != TEXTURE_NORMAL || ch < 3)
+					continue;
+				float n[3], len = 0.0f;
+				for (int c = 0; c < 3; c++) {
+					n[c] = p[c] * 2.0f - 1.0f;
+					len += n[c] * n[c];
+				}
+				len = std::sqrt(len);
+				if (len < 1e-6f)
+					continue;
+				for (int c = 0; c < 3; c++)
+					p[c] = n[c] / len * 0.5f + 0.5f;
+			}
+		}
+	});
+}
+
+static void encode(const Float_image &img, Texture_usage usage, Mip_level &out,
+		unsigned int threads) {
+	const Srgb_tables &t = srgb_tables();
+	int ch = img.channels;
+	bool gamma[4];
+	for (int c = 0; c < ch; c++)
+		gamma[c] = is_gamma(c, ch, usage);
+	out.width = img.width;
+	out.height = img.height;
+	out.pixels.resize(img.pixels.size());
+	parallel_rows(img.height, threads, [&](int y0, int y1) {
+		const float *p = img.pixels.data() + (size_t)y0 * img.width * ch;
+		unsigned char *o = out.pixels.data() + (size_t)y0 * img.width * ch;
+		for (size_t i = 0; i < (size_t)(y1 - y0) * img.width; i++)
+			for (int c = 0; c < ch; c++, p++, o++)
+				*o = gamma[c] ? t.to_srgb[(int)(*p * (MIP_SRGB_STEPS - 1) + 0.5f)] :
+					(unsigned char)(*p * 255.0f + 0.5f);
+	});
+}
+
+void mip_generate(const unsigned char *pixels, int width, int height,
+		int channels, std::vector<Mip_level> &levels, Mip_filter filter,
+		Texture_usage usage, unsigned int threads) {
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	levels.clear();
+	Float_image cur, next;
+	decode(pixels, width, height, channels, usage, cur, threads);
+	while (cur.width > 1 || cur.height > 1) {
+		downsample(cur, next, filter, threads);
+		fix_up(next, usage, threads);
+		levels.push_back(Mip_level());
+		encode(next, usage, levels.back(), threads);
+		cur.pixels.swap(next.pixels);
+		cur.width = next.width;
+		cur.height = next.height;
+	}
+}
@@ -2,6 +2,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <map>
+#include <cmath>
 
 Model::Model(const std::string &f) {
 	Assimp::Importer import;
@@ -15,6 +17,25 @@ Model::Model(const std::string &f) {
 		std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
 		return;
 	}
+
+	size_t slash = f.rfind('/');
+	if (slash != std::string::npos)
+		directory = f.substr(0, slash + 1);
+
+	for (unsigned int i=0; i<scene->mNumMaterials; i++) {
+		aiMaterial *mat = scene->mMaterials[i];
+		Material m;
+		aiString path;
+		if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0 &&
+				mat->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS)
+			m.diffuse_map = path.C_Str();
+		aiColor3D kd(1.0f, 1.0f, 1.0f);
+		mat->Get(AI_MATKEY_COLOR_DIFFUSE, kd);
+		m.color[0] = kd.r;
+		m.color[1] = kd.g;
+		m.color[2] = kd.b;
+		materials.push_back(m);
+	}
 	process_node(scene->mRootNode, scene);
 }
 
@@ -62,6 +83,7 @@ void Model::process_mesh(aiMesh *mesh, const aiScene *scene) {
 			m.indices.push_back(face.mIndices[j]);
 	}
 
+	m.material = mesh->mMaterialIndex;
 	meshes.push_back(std::move(m));
 }
 
@@ -75,3 +97,38 @@ void Model::draw(void) {
 		meshes[i].draw();
 }
 
+void Model::load_textures(TextureArray &textures, bool verticalFlip) {
+	std::map<std::string, int> loaded; // Materials may share a map
+	vector<int> slots;
+	for (unsigned int i=0; i<materials.size(); i++) {
+		const Material &m = materials[i];
+		int slot = -1;
+		if (!m.diffuse_map.empty()) {
+			auto found = loaded.find(m.diffuse_map);
+			if (found != loaded.end())
+				slot = found->second;
+			else {
+				slot = textures.add(directory + m.diffuse_map, verticalFlip);
+				loaded[m.diffuse_map] = slot;
+			}
+		}
+		if (slot < 0)
+			slot = textures.add_color(m.color[0], m.color[1], m.color[2]);
+		slots.push_back(slot);
+	}
+
+	for (unsigned int i=0; i<meshes.size(); i++)
+		if (meshes[i].material < slots.size())
+			meshes[i].material = slots[meshes[i].material];
+}
+
+float Model::uv_scale(void) const {
+	float area = 0.0f, uv = 0.0f;
+	for (unsigned int i=0; i<meshes.size(); i++) {
+		float a, u;
+		meshes[i].uv_area(a, u);
+		area += a;
+		uv += u;
+	}
+	return uv > 0.0f ? std::sqrt(area / uv) : 0.0f;
+}
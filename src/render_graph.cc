@@ -0,0 +1,356 @@
+#include <render_graph.hh>
+#include <gl_state.hh>
+#include <iostream>
+#include <algorithm>
+
+static bool same_desc(const Rg_texture &a, const Rg_texture &b) {
+	return a.internal_format == b.internal_format && a.format == b.format
+		&& a.type == b.type && a.filter == b.filter && a.divisor == b.divisor;
+}
+
+// Most drivers' footprint, for the report
+static int texel_bytes(GLint internal_format) {
+	switch (internal_format) {
+	case GL_RED:
+	case GL_R8:
+		return 1;
+	case GL_RGB16F:
+		return 6;
+	case GL_RGBA16F:
+	case GL_RG32F:
+		return 8;
+	case GL_RGBA32F:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+RenderGraph::RenderGraph() : screen_w(0), screen_h(0), texture_count(0),
+		pass_count(0), changed(true), live_count(0) {}
+
+RenderGraph::~RenderGraph() {
+	free_framebuffers();
+	for (unsigned int i = 0; i < pool.size(); i++)
+		gl_delete_textures(1, &pool[i].texture);
+}
+
+void RenderGraph::resize(int width, int height) {
+	if (width != screen_w || height != screen_h)
+		changed = true;
+	screen_w = width;
+	screen_h = height;
+}
+
+// The declarations overwrite last frame's in place, noting any difference
+RenderGraph::Resource RenderGraph::texture(const char *name,
+		const Rg_texture &desc, bool persistent) {
+	if (texture_count == textures.size()) {
+		textures.push_back(Texture());
+		changed = true;
+	}
+	Texture &t = textures[texture_count];
+	if (t.name != name || !same_desc(t.desc, desc)
+			|| t.persistent != persistent) {
+		t.name = name;
+		t.desc = desc;
+		t.persistent = persistent;
+		changed = true;
+	}
+	return texture_count++;
+}
+
+void RenderGraph::pass(const char *name, const std::vector<Resource> &inputs,
+		const std::vector<Resource> &outputs,
+		std::function<void(void)> run) {
+	if (pass_count == passes.size()) {
+		passes.push_back(Pass());
+		changed = true;
+	}
+	Pass &p = passes[pass_count++];
+	if (p.name != name || p.inputs != inputs || p.outputs != outputs) {
+		p.name = name;
+		p.inputs.assign(inputs.begin(), inputs.end());
+		p.outputs.assign(outputs.begin(), outputs.end());
+		changed = true;
+	}
+	p.run = std::move(run);
+}
+
+void RenderGraph::execute(void) {
+	if (texture_count != textures.size() || pass_count != passes.size()) {
+		textures.resize(texture_count);
+		passes.resize(pass_count);
+		changed = true;
+	}
+	if (changed) {
+		cull();
+		allocate();
+		changed = false;
+	}
+	else
+		fresh.assign(textures.size(), false);
+
+	for (unsigned int i = 0; i < passes.size(); i++) {
+		Pass &p = passes[i];
+		if (!p.live)
+			continue;
+		if (p.outputs.empty() || p.outputs[0] == BACKBUFFER) {
+			gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, screen_w, screen_h);
+		}
+		else {
+			gl_bind_framebuffer(GL_FRAMEBUFFER, pass_framebuffers[i]);
+			glViewport(0, 0, width(p.outputs[0]), height(p.outputs[0]));
+		}
+		p.run();
+	}
+	gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, screen_w, screen_h);
+
+	texture_count = 0;
+	pass_count = 0;
+}
+
+GLuint RenderGraph::gl_texture(Resource r) const {
+	return pool[assigned[r]].texture;
+}
+
+int RenderGraph::width(Resource r) const {
+	return pool[assigned[r]].w;
+}
+
+int RenderGraph::height(Resource r) const {
+	return pool[assigned[r]].h;
+}
+
+GLuint RenderGraph::framebuffer(Resource r) const {
+	for (unsigned int i = 0; i < passes.size(); i++)
+		for (unsigned int j = 0; j < passes[i].outputs.size(); j++)
+			if (passes[i].live && passes[i].outputs[j] == r)
+				return pass_framebuffers[i];
+	return 0;
+}
+
+bool RenderGraph::created(Resource r) const {
+	return fresh[r];
+}
+
+size_t RenderGraph::texture_bytes(void) const {
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < pool.size(); i++)
+		bytes += (size_t)pool[i].w * pool[i].h
+			* texel_bytes(pool[i].desc.internal_format);
+	return bytes;
+}
+
+// private
+
+// Backwards from the passes drawing on screen: a pass is live if something
+// live reads one of its outputs
+void RenderGraph::cull(void) {
+	std::vector<bool> needed(textures.size(), false);
+	live_count = 0;
+	for (int i = passes.size() - 1; i >= 0; i--) {
+		Pass &p = passes[i];
+		p.live = false;
+		for (unsigned int j = 0; j < p.outputs.size(); j++)
+			if (p.outputs[j] == BACKBUFFER || needed[p.outputs[j]])
+				p.live = true;
+		if (!p.live)
+			continue;
+		live_count++;
+		for (unsigned int j = 0; j < p.inputs.size(); j++)
+			needed[p.inputs[j]] = true;
+	}
+}
+
+/*
+ * Gives every texture used by a live pass a GL texture: persistent ones get
+ * theirs back, transient ones take a free one from the pool when they're
+ * first written and give it back after their last use. What's left in the
+ * pool is freed.
+ */
+void RenderGraph::allocate(void) {
+	int n = textures.size();
+	std::vector<int> first(n, -1), last(n, -1);
+	for (unsigned int i = 0; i < passes.size(); i++) {
+		if (!passes[i].live)
+			continue;
+		std::vector<Resource> used = passes[i].inputs;
+		used.insert(used.end(), passes[i].outputs.begin(),
+				passes[i].outputs.end());
+		for (unsigned int j = 0; j < used.size(); j++) {
+			Resource r = used[j];
+			if (r == BACKBUFFER)
+				continue;
+			if (first[r] < 0)
+				first[r] = i;
+			last[r] = i;
+		}
+	}
+
+	assigned.assign(n, -1);
+	fresh.assign(n, false);
+	std::vector<bool> taken(pool.size(), false); // By this allocation
+	std::vector<bool> busy(pool.size(), false);  // Right now, transient
+	int w, h;
+	for (int r = 0; r < n; r++)
+		if (first[r] >= 0 && textures[r].persistent) {
+			size_of(textures[r].desc, w, h);
+			assigned[r] = find_physical(textures[r].desc, w, h,
+					textures[r].name, taken);
+		}
+	for (unsigned int i = 0; i < passes.size(); i++) {
+		if (!passes[i].live)
+			continue;
+		for (int r = 0; r < n; r++) {
+			if (first[r] != (int)i || textures[r].persistent)
+				continue;
+			size_of(textures[r].desc, w, h);
+			int found = -1;
+			for (unsigned int k = 0; k < pool.size() && found < 0; k++)
+				if (taken[k] && !busy[k] && pool[k].owner.empty()
+						&& same_desc(pool[k].desc, textures[r].desc)
+						&& pool[k].w == w && pool[k].h == h)
+					found = k;
+			if (found < 0) {
+				found = find_physical(textures[r].desc, w, h, "", taken);
+				busy.resize(pool.size(), false);
+			}
+			busy[found] = true;
+			assigned[r] = found;
+		}
+		for (int r = 0; r < n; r++)
+			if (last[r] == (int)i && !textures[r].persistent)
+				busy[assigned[r]] = false;
+	}
+	for (int r = 0; r < n; r++)
+		fresh[r] = assigned[r] >= 0 && pool[assigned[r]].texture == 0;
+	int changed = 0;
+	for (int r = 0; r < n; r++) {
+		if (assigned[r] < 0 || pool[assigned[r]].texture)
+			continue;
+		changed++;
+		Physical &p = pool[assigned[r]];
+		glGenTextures(1, &p.texture);
+		gl_bind_texture(GL_TEXTURE_2D, p.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, p.desc.internal_format, p.w, p.h, 0,
+				p.desc.format, p.desc.type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, p.desc.filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, p.desc.filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	// Free the rest, the indices of what's kept shift down
+	std::vector<int> moved(pool.size(), -1);
+	std::vector<Physical> kept;
+	for (unsigned int k = 0; k < pool.size(); k++)
+		if (taken[k]) {
+			moved[k] = kept.size();
+			kept.push_back(pool[k]);
+		}
+		else {
+			free_framebuffers(pool[k].texture);
+			gl_delete_textures(1, &pool[k].texture);
+			changed++;
+		}
+	pool.swap(kept);
+	for (int r = 0; r < n; r++)
+		if (assigned[r] >= 0)
+			assigned[r] = moved[assigned[r]];
+
+	pass_framebuffers.assign(passes.size(), 0);
+	for (unsigned int i = 0; i < passes.size(); i++)
+		if (passes[i].live && !passes[i].outputs.empty()
+				&& passes[i].outputs[0] != BACKBUFFER)
+			pass_framebuffers[i] = make_framebuffer(passes[i]);
+	gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+	if (!changed)
+		return;
+
+	int used = 0;
+	for (int r = 0; r < n; r++)
+		used += first[r] >= 0;
+	std::cout << "Render graph: " << live_count << " of " << passes.size()
+		<< " passes, " << used << " textures in " << pool.size() << ", "
+		<< texture_bytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// An unused texture of the pool matching, or a new entry (no GL texture
+// yet) at the end
+int RenderGraph::find_physical(const Rg_texture &desc, int w, int h,
+		const std::string &owner, std::vector<bool> &taken) {
+	for (unsigned int k = 0; k < taken.size(); k++)
+		if (!taken[k] && pool[k].owner == owner && same_desc(pool[k].desc, desc)
+				&& pool[k].w == w && pool[k].h == h) {
+			taken[k] = true;
+			return k;
+		}
+	Physical p;
+	p.desc = desc;
+	p.w = w;
+	p.h = h;
+	p.texture = 0;
+	p.owner = owner;
+	pool.push_back(p);
+	taken.push_back(true);
+	return pool.size() - 1;
+}
+
+GLuint RenderGraph::make_framebuffer(const Pass &p) {
+	std::vector<GLuint> attached;
+	for (unsigned int j = 0; j < p.outputs.size(); j++)
+		attached.push_back(gl_texture(p.outputs[j]));
+	std::map<std::vector<GLuint>, GLuint>::iterator it =
+		framebuffers.find(attached);
+	if (it != framebuffers.end())
+		return it->second;
+
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	gl_bind_framebuffer(GL_FRAMEBUFFER, fbo);
+	std::vector<GLenum> colors;
+	for (unsigned int j = 0; j < p.outputs.size(); j++) {
+		const Rg_texture &desc = textures[p.outputs[j]].desc;
+		GLenum attachment = GL_COLOR_ATTACHMENT0 + colors.size();
+		if (desc.format == GL_DEPTH_STENCIL)
+			attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+		else if (desc.format == GL_DEPTH_COMPONENT)
+			attachment = GL_DEPTH_ATTACHMENT;
+		else
+			colors.push_back(attachment);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D,
+				attached[j], 0);
+	}
+	if (colors.empty())
+		glDrawBuffer(GL_NONE);
+	else
+		glDrawBuffers(colors.size(), colors.data());
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Render graph: framebuffer of " << p.name
+			<< " not complete" << std::endl;
+	framebuffers[attached] = fbo;
+	return fbo;
+}
+
+// Those with `texture` attached, all of them for 0
+void RenderGraph::free_framebuffers(GLuint texture) {
+	std::map<std::vector<GLuint>, GLuint>::iterator it = framebuffers.begin();
+	while (it != framebuffers.end()) {
+		const std::vector<GLuint> &attached = it->first;
+		if (texture && std::find(attached.begin(), attached.end(), texture)
+				== attached.end()) {
+			it++;
+			continue;
+		}
+		gl_delete_framebuffers(1, &it->second);
+		framebuffers.erase(it++);
+	}
+}
+
+void RenderGraph::size_of(const Rg_texture &desc, int &w, int &h) const {
+	w = (screen_w + desc.divisor - 1) / desc.divisor;
+	h = (screen_h + desc.divisor - 1) / desc.divisor;
+}
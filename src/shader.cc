@@ -1,120 +1,615 @@
 #include "shader.hh"
 //#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <gl_ext.hh>
+#include <gl_state.hh>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sys/stat.h>
+
+std::string Shader::cache_dir = ".shader_cache";
+unsigned int Shader::cache_hits = 0;
+unsigned int Shader::cache_misses = 0;
+
+// Header of a cached program binary
+struct Program_file_header {
+	char magic[4];      // "GLPB"
+	uint64_t key;       // program_key()
+	uint32_t format;    // Binary format from glGetProgramBinary
+	uint32_t length;    // Bytes following the header
+};
+
+static void hash_bytes(uint64_t &hash, const char *data, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+	// Separator, so "ab" + "c" and "a" + "bc" differ
+	hash = (hash ^ 0xFF) * 1099511628211ull;
+}
+
+static void hash_string(uint64_t &hash, const GLubyte *s) {
+	const char *c = s ? (const char *)s : "";
+	hash_bytes(hash, c, strlen(c));
+}
+
+// 64 bit FNV-1a of both sources and of the driver that compiles them
+static uint64_t program_key(const std::string &vertexCode,
+		const std::string &fragmentCode) {
+	uint64_t hash = 14695981039346656037ull;
+	hash_bytes(hash, vertexCode.data(), vertexCode.size());
+	hash_bytes(hash, fragmentCode.data(), fragmentCode.size());
+	hash_string(hash, glGetString(GL_VENDOR));
+	hash_string(hash, glGetString(GL_RENDERER));
+	hash_string(hash, glGetString(GL_VERSION));
+	return hash;
+}
+
+/**
+ * Appends the file at `path` to `out`, with its #include "file" lines
+ * replaced by the files (once each, `included` holds those already in).
+ * #line directives keep compiler messages on the right line; their source
+ * string number is the index of the file in `files`. In the main file the
+ * defines go right after #version, which has to stay first.
+ */
+static bool preprocess(const std::string &path, const std::string &defines,
+		std::vector<std::string> &files, std::set<std::string> &included,
+		std::string &out) {
+	std::ifstream in(path.c_str());
+	if (!in)
+		return false;
+	included.insert(path);
+	unsigned int number = std::find(files.begin(), files.end(), path)
+		- files.begin();
+	if (number == files.size())
+		files.push_back(path);
+	bool main_file = included.size() == 1;
+	std::string dir = path.substr(0, path.find_last_of('/') + 1);
+
+	if (!main_file)
+		out += "#line 1 " + std::to_string(number) + "\n";
+	std::string line;
+	for (int n = 1; std::getline(in, line); n++) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] != '#') {
+			out += line + "\n";
+			continue;
+		}
+		std::string directive = line.substr(start);
+		if (directive.compare(0, 8, "#version") == 0) {
+			if (main_file)
+				out += line + "\n" + defines;
+			out += "#line " + std::to_string(n + 1) + " "
+				+ std::to_string(number) + "\n";
+			continue;
+		}
+		if (directive.compare(0, 8, "#include") != 0) {
+			out += line + "\n";
+			continue;
+		}
+		size_t open = directive.find('"'), close = directive.rfind('"');
+		if (open == std::string::npos || close <= open) {
+			std::cout << "ERROR::SHADER::BAD_INCLUDE " << path << ":" << n
+				<< std::endl;
+			return false;
+		}
+		std::string file = dir + directive.substr(open + 1, close - open - 1);
+		if (!included.count(file)) {
+			if (!preprocess(file, defines, files, included, out)) {
+				std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << file
+					<< " in " << path << std::endl;
+				return false;
+			}
+		}
+		out += "#line " + std::to_string(n + 1) + " " + std::to_string(number)
+			+ "\n";
+	}
+	return true;
+}
+
+static std::string binary_path(uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+	return Shader::cache_dir + name;
+}
 
 // public
 // constructor generates the shader on the fly
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
-	// 1. retrieve the vertex/fragment source code from filePath
+Shader::Shader(const char* vertexPath, const char* fragmentPath,
+		const Shader_defines &defines, bool wait) :
+		linking(false), key(0), fallback(NULL), vertex_path(vertexPath),
+		fragment_path(fragmentPath), defines(defines), next_ID(0),
+		next_key(0) {
+	stages[0] = stages[1] = 0;
+	next_stages[0] = next_stages[1] = 0;
+	// 1. retrieve the vertex/fragment source code from filePath, with the
+	// includes and defines
 	std::string vertexCode;
 	std::string fragmentCode;
-	std::ifstream vShaderFile;
-	std::ifstream fShaderFile;
-
-	// ensure ifstream objects can throw exceptions:
-	vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-	fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-	try {
-		// open files
-		vShaderFile.open(vertexPath);
-		fShaderFile.open(fragmentPath);
-		std::stringstream vShaderStream, fShaderStream;
-
-		// read file's buffer contents into streams
-		vShaderStream << vShaderFile.rdbuf();
-		fShaderStream << fShaderFile.rdbuf();
-
-		// close file handlers
-		vShaderFile.close();
-		fShaderFile.close();
-
-		// convert stream into string
-		vertexCode   = vShaderStream.str();
-		fragmentCode = fShaderStream.str();
-	}
-	catch (std::ifstream::failure &e) {
-		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+	readSources(vertexCode, fragmentCode, files);
+
+	// 2. take the cached binary, or start compiling and linking
+	key = program_key(vertexCode, fragmentCode);
+	if (loadBinary(key)) {
+		cache_hits++;
+		reflectUniforms();
+		reflectBlocks();
+		return;
 	}
-	const char* vShaderCode = vertexCode.c_str();
-	const char * fShaderCode = fragmentCode.c_str();
+	cache_misses++;
+	ID = compile(vertexCode, fragmentCode, stages);
+	linking = true;
+	if (wait)
+		finish();
+}
 
-	// 2. compile shaders
-	unsigned int vertex, fragment;
+bool Shader::use() {
+	if (linking && fallback && !ready()) {
+		fallback->use();
+		return false;
+	}
+	finish();
+	gl_use_program(ID);
+	return true;
+}
 
-	// vertex shader
-	vertex = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex, 1, &vShaderCode, NULL);
-	glCompileShader(vertex);
-	checkCompileErrors(vertex, "VERTEX");
+bool Shader::ready(void) const {
+	if (!linking || !gl_ext().parallel_compile)
+		return true;
+	GLint done = GL_FALSE;
+	glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
 
-	// fragment Shader
-	fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fShaderCode, NULL);
-	glCompileShader(fragment);
-	checkCompileErrors(fragment, "FRAGMENT");
+void Shader::finish(void) {
+	if (!linking)
+		return;
+	linking = false;
+	checkErrors(ID, stages, files);
+	saveBinary(key);
+	reflectUniforms();
+	reflectBlocks();
 
-	// shader Program
-	ID = glCreateProgram();
-	glAttachShader(ID, vertex);
-	glAttachShader(ID, fragment);
-	glLinkProgram(ID);
-	checkCompileErrors(ID, "PROGRAM");
+	gl_use_program(ID);
+	for (unsigned int i = 0; i < ready_callbacks.size(); i++)
+		ready_callbacks[i](*this);
+	ready_callbacks.clear();
+}
 
-	// delete the shaders as they're linked into our program now and no longer necessary
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
+void Shader::reload(void) {
+	finish();
+	dropReload();
+	std::string vertexCode, fragmentCode;
+	next_files.clear();
+	if (!readSources(vertexCode, fragmentCode, next_files))
+		return;
+	next_key = program_key(vertexCode, fragmentCode);
+	next_ID = compile(vertexCode, fragmentCode, next_stages);
+}
+
+int Shader::swapReloaded(void) {
+	if (!next_ID)
+		return 0;
+	if (gl_ext().parallel_compile) {
+		GLint done = GL_FALSE;
+		glGetProgramiv(next_ID, GL_COMPLETION_STATUS_KHR, &done);
+		if (done != GL_TRUE)
+			return 0;
+	}
+	if (!checkErrors(next_ID, next_stages, next_files)) {
+		std::cout << "Keeping the previous " << vertex_path << " + "
+			<< fragment_path << std::endl;
+		dropReload();
+		return -1;
+	}
+
+	// Uniform values live in the program, read them from the old one
+	std::vector<GLfloat> floats(uniforms.size() * 16);
+	std::vector<GLint> ints(uniforms.size() * 4);
+	std::vector<GLenum> types(uniforms.size());
+	for (unsigned int i = 0; i < uniforms.size(); i++) {
+		types[i] = uniforms[i].location >= 0 ? uniforms[i].type : 0;
+		if (!types[i])
+			continue;
+		if (isFloatType(types[i]))
+			glGetUniformfv(ID, uniforms[i].location, &floats[i * 16]);
+		else
+			glGetUniformiv(ID, uniforms[i].location, &ints[i * 4]);
+	}
+
+	gl_delete_program(ID);
+	ID = next_ID;
+	key = next_key;
+	files.swap(next_files);
+	next_ID = 0;
+	saveBinary(key);
+	reflectUniforms();
+	reflectBlocks();
+
+	gl_use_program(ID);
+	for (unsigned int i = 0; i < uniforms.size() && i < types.size(); i++)
+		if (types[i] && types[i] == uniforms[i].type)
+			restoreUniform(uniforms[i].location, types[i], &floats[i * 16],
+					&ints[i * 4]);
+	return 1;
 }
 
-void Shader::use() {
-	glUseProgram(ID);
+void Shader::onReady(const std::function<void(Shader &)> &callback) {
+	if (linking) {
+		ready_callbacks.push_back(callback);
+		return;
+	}
+	gl_use_program(ID);
+	callback(*this);
 }
 
 void Shader::setBool(const std::string &name, bool value) const {
-	glUniform1i(getLocation(name), (int)value);
+	int slot = slotOf(name);
+	int v = value;
+	if (changed(slot, &v, sizeof(v)))
+		glUniform1i(location(slot), v);
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-	glUniform1i(getLocation(name), value);
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform1i(location(slot), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
-	glUniform1f(getLocation(name), value);
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform1f(location(slot), value);
 }
 
 void Shader::setMat(const std::string &name, const glm::mat2 &value) const {
-	glUniformMatrix2fv(getLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix2fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setMat(const std::string &name, const glm::mat3 &value) const {
-	glUniformMatrix3fv(getLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix3fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setMat(const std::string &name, const glm::mat4 &value) const {
-	glUniformMatrix4fv(getLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix4fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setVec(const std::string &name, const glm::vec2 &value) const {
-	glUniform2fv(getLocation(name), 1, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform2fv(location(slot), 1, glm::value_ptr(value));
 }
 
 void Shader::setVec(const std::string &name, const glm::vec3 &value) const {
-	glUniform3fv(getLocation(name), 1, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform3fv(location(slot), 1, glm::value_ptr(value));
 }
 
 void Shader::setVec(const std::string &name, const glm::vec4 &value) const {
-	glUniform4fv(getLocation(name), 1, glm::value_ptr(value));
+	int slot = slotOf(name);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform4fv(location(slot), 1, glm::value_ptr(value));
 }
 
+// From the table built at link time, no GL query
 unsigned int Shader::getLocation(const std::string &name) const {
-	int loc = glGetUniformLocation(ID, name.c_str());
-	if (loc == -1)
-		std::cout << "Uniform '" << name << "' not found" << std::endl;
-	return loc;
+	return location(slotOf(name));
+}
+
+void Shader::setBool(Uniform_id id, bool value) const {
+	int slot = slotOf(id);
+	int v = value;
+	if (changed(slot, &v, sizeof(v)))
+		glUniform1i(location(slot), v);
+}
+
+void Shader::setInt(Uniform_id id, int value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform1i(location(slot), value);
+}
+
+void Shader::setFloat(Uniform_id id, float value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform1f(location(slot), value);
+}
+
+void Shader::setMat(Uniform_id id, const glm::mat2 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix2fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setMat(Uniform_id id, const glm::mat3 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix3fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setMat(Uniform_id id, const glm::mat4 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniformMatrix4fv(location(slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setVec(Uniform_id id, const glm::vec2 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform2fv(location(slot), 1, glm::value_ptr(value));
+}
+
+void Shader::setVec(Uniform_id id, const glm::vec3 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform3fv(location(slot), 1, glm::value_ptr(value));
+}
+
+void Shader::setVec(Uniform_id id, const glm::vec4 &value) const {
+	int slot = slotOf(id);
+	if (changed(slot, &value, sizeof(value)))
+		glUniform4fv(location(slot), 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<int> h, int value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniform1i(location(h.slot), value);
+}
+
+void Shader::set(UniformHandle<float> h, float value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniform1f(location(h.slot), value);
+}
+
+void Shader::set(UniformHandle<glm::mat2> h, const glm::mat2 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniformMatrix2fv(location(h.slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::mat3> h, const glm::mat3 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniformMatrix3fv(location(h.slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::mat4> h, const glm::mat4 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniformMatrix4fv(location(h.slot), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec2> h, const glm::vec2 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniform2fv(location(h.slot), 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec3> h, const glm::vec3 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniform3fv(location(h.slot), 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec4> h, const glm::vec4 &value) const {
+	if (changed(h.slot, &value, sizeof(value)))
+		glUniform4fv(location(h.slot), 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec3> h, const glm::vec3 *values,
+		int count) const {
+	forget(h.slot, count);
+	glUniform3fv(location(h.slot), count, glm::value_ptr(values[0]));
+}
+
+void Shader::set(UniformHandle<glm::vec4> h, const glm::vec4 *values,
+		int count) const {
+	forget(h.slot, count);
+	glUniform4fv(location(h.slot), count, glm::value_ptr(values[0]));
+}
+
+void Shader::bindBlock(const std::string &name, unsigned int binding) {
+	for (unsigned int i = 0; i < blocks.size(); i++) {
+		if (blocks[i].name != name)
+			continue;
+		blocks[i].binding = binding;
+		if (blocks[i].index >= 0)
+			glUniformBlockBinding(ID, blocks[i].index, binding);
+		return;
+	}
+	if (!linking) {
+		std::cout << "Uniform block '" << name << "' not found" << std::endl;
+		return;
+	}
+	// Applied by reflectBlocks()
+	Block block;
+	block.name = name;
+	block.index = -1;
+	block.size = 0;
+	block.binding = binding;
+	blocks.push_back(block);
+}
+
+GLint Shader::blockSize(const std::string &name) const {
+	for (unsigned int i = 0; i < blocks.size(); i++)
+		if (blocks[i].name == name && blocks[i].index >= 0)
+			return blocks[i].size;
+	return -1;
+}
+
+GLint Shader::offsetOf(const std::string &member) const {
+	int slot = findSlot(uniform_id(member.c_str()));
+	return slot >= 0 && uniforms[slot].block >= 0 ? uniforms[slot].offset : -1;
 }
 
 // private
-void Shader::checkCompileErrors(unsigned int shader, std::string type) {
+// Starts compiling, status queries wait for the compiler and are left to
+// checkErrors()
+unsigned int Shader::compile(const std::string &vertexCode,
+		const std::string &fragmentCode, unsigned int *stages) {
+	const char* vShaderCode = vertexCode.c_str();
+	const char * fShaderCode = fragmentCode.c_str();
+
+	// compile shaders
+	unsigned int vertex, fragment;
+
+	// vertex shader
+	vertex = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertex, 1, &vShaderCode, NULL);
+	glCompileShader(vertex);
+
+	// fragment Shader
+	fragment = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragment, 1, &fShaderCode, NULL);
+	glCompileShader(fragment);
+
+	// shader Program
+	unsigned int program = glCreateProgram();
+	if (gl_ext().ProgramParameteri && !cache_dir.empty())
+		gl_ext().ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+				GL_TRUE);
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	glLinkProgram(program);
+
+	stages[0] = vertex;
+	stages[1] = fragment;
+	return program;
+}
+
+bool Shader::checkErrors(unsigned int program, unsigned int *stages,
+		const std::vector<std::string> &paths) {
+	bool ok = checkCompileErrors(stages[0], "VERTEX", paths);
+	ok = checkCompileErrors(stages[1], "FRAGMENT", paths) && ok;
+	ok = checkCompileErrors(program, "PROGRAM", paths) && ok;
+
+	// delete the shaders as they're linked into our program now and no longer necessary
+	glDeleteShader(stages[0]);
+	glDeleteShader(stages[1]);
+	stages[0] = stages[1] = 0;
+	return ok;
+}
+
+// Sources with their includes and defines, `paths` gets every file read
+bool Shader::readSources(std::string &vertexCode, std::string &fragmentCode,
+		std::vector<std::string> &paths) const {
+	std::string define_lines;
+	for (unsigned int i = 0; i < defines.size(); i++)
+		define_lines += "#define " + defines[i].first + " "
+			+ defines[i].second + "\n";
+
+	std::set<std::string> vIncluded, fIncluded;
+	if (!preprocess(vertex_path, define_lines, paths, vIncluded, vertexCode)
+			|| !preprocess(fragment_path, define_lines, paths, fIncluded,
+				fragmentCode)) {
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Shader::dropReload(void) {
+	if (!next_ID)
+		return;
+	glDeleteShader(next_stages[0]);
+	glDeleteShader(next_stages[1]);
+	next_stages[0] = next_stages[1] = 0;
+	gl_delete_program(next_ID);
+	next_ID = 0;
+}
+
+bool Shader::isFloatType(GLenum type) {
+	switch (type) {
+	case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+	case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+		return true;
+	}
+	return false;
+}
+
+// Sets a value read with glGetUniform*v, on the bound program. Ints are
+// ints, bools and samplers.
+void Shader::restoreUniform(GLint location, GLenum type, const GLfloat *f,
+		const GLint *i) {
+	switch (type) {
+	case GL_FLOAT: glUniform1fv(location, 1, f); break;
+	case GL_FLOAT_VEC2: glUniform2fv(location, 1, f); break;
+	case GL_FLOAT_VEC3: glUniform3fv(location, 1, f); break;
+	case GL_FLOAT_VEC4: glUniform4fv(location, 1, f); break;
+	case GL_FLOAT_MAT2: glUniformMatrix2fv(location, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, GL_FALSE, f); break;
+	case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, GL_FALSE, f); break;
+	case GL_INT_VEC2: glUniform2iv(location, 1, i); break;
+	case GL_INT_VEC3: glUniform3iv(location, 1, i); break;
+	case GL_INT_VEC4: glUniform4iv(location, 1, i); break;
+	default: glUniform1iv(location, 1, i); break;
+	}
+}
+
+// Leaves ID at 0 when there is no usable binary
+bool Shader::loadBinary(uint64_t key) {
+	ID = 0;
+	if (cache_dir.empty() || !gl_ext().ProgramBinary)
+		return false;
+	std::ifstream in(binary_path(key).c_str(), std::ios::binary);
+	Program_file_header h;
+	if (!in.read((char *)&h, sizeof(h)) || memcmp(h.magic, "GLPB", 4) != 0 ||
+			h.key != key)
+		return false;
+	std::vector<char> binary(h.length);
+	if (!in.read(binary.data(), binary.size()))
+		return false;
+
+	ID = glCreateProgram();
+	gl_ext().ProgramBinary(ID, h.format, binary.data(), binary.size());
+	GLint linked = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+	if (linked)
+		return true;
+	// Driver update or a format it no longer takes, compile again
+	gl_delete_program(ID);
+	ID = 0;
+	return false;
+}
+
+void Shader::saveBinary(uint64_t key) {
+	GLint linked = GL_FALSE, length = 0;
+	glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+	if (cache_dir.empty() || !gl_ext().GetProgramBinary || !linked)
+		return;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	Program_file_header h;
+	memcpy(h.magic, "GLPB", 4);
+	h.key = key;
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	gl_ext().GetProgramBinary(ID, length, &written, &format, binary.data());
+	h.format = format;
+	h.length = written;
+
+	// Written aside and renamed, so a crash never leaves half a file
+	mkdir(cache_dir.c_str(), 0755);
+	std::string path = binary_path(key);
+	std::string tmp = path + ".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	out.write((const char *)&h, sizeof(h));
+	out.write(binary.data(), written);
+	out.close();
+	if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+		std::cout << "Can't write shader cache " << path << std::endl;
+		remove(tmp.c_str());
+	}
+}
+
+bool Shader::checkCompileErrors(unsigned int shader, std::string type,
+		const std::vector<std::string> &paths) {
 	int success;
 	char infoLog[1024];
 	if (type != "PROGRAM") {
@@ -122,6 +617,8 @@ void Shader::checkCompileErrors(unsigned int shader, std::string type) {
 		if (!success) {
 			glGetShaderInfoLog(shader, 1024, NULL, infoLog);
 			std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog;
+			for (unsigned int i = 0; i < paths.size(); i++)
+				std::cout << "  " << i << ": " << paths[i] << "\n";
 			std::cout << "\n -- ------------------------------------ -- " << std::endl;
 		}
 	}
@@ -134,4 +631,210 @@ void Shader::checkCompileErrors(unsigned int shader, std::string type) {
 			std::cout << "\n -- ------------------------------------ -- " << std::endl;
 		}
 	}
+	return success;
+}
+
+/**
+ * Fills the uniform table from glGetActiveUniform. Slots from an earlier
+ * link keep their names, so handles survive relinking; uniforms that went
+ * away keep their slot with location -1.
+ */
+void Shader::reflectUniforms(void) {
+	for (unsigned int i = 0; i < uniforms.size(); i++) {
+		uniforms[i].location = -1;
+		uniforms[i].block = -1;
+		uniforms[i].value_size = 0;
+	}
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> buffer(max_length + 1);
+	for (GLint i = 0; i < count; i++) {
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(ID, i, buffer.size(), &length, &size, &type,
+				buffer.data());
+		std::string name(buffer.data(), length);
+		GLuint u = i;
+		GLint block = -1, offset = -1, stride = 0;
+		glGetActiveUniformsiv(ID, 1, &u, GL_UNIFORM_BLOCK_INDEX, &block);
+		glGetActiveUniformsiv(ID, 1, &u, GL_UNIFORM_OFFSET, &offset);
+		glGetActiveUniformsiv(ID, 1, &u, GL_UNIFORM_ARRAY_STRIDE, &stride);
+
+		// Arrays are reported once as "name[0]", with their size
+		std::string base = name;
+		bool array = name.size() > 3 &&
+			name.compare(name.size() - 3, 3, "[0]") == 0;
+		if (array)
+			base = name.substr(0, name.size() - 3);
+		for (GLint e = 0; e < size; e++) {
+			std::string element = array ?
+				base + "[" + std::to_string(e) + "]" : name;
+			GLint loc = -1;
+			if (block < 0) {
+				loc = glGetUniformLocation(ID, element.c_str());
+				if (loc < 0)
+					continue;
+			}
+			int slot = addSlot(uniform_id(element.c_str()), element);
+			uniforms[slot].location = loc;
+			uniforms[slot].type = type;
+			uniforms[slot].block = block;
+			uniforms[slot].offset = block < 0 ? -1 : offset + e * stride;
+			if (array && e == 0 && findSlot(uniform_id(base.c_str())) < 0) {
+				std::pair<Uniform_id, int> entry(uniform_id(base.c_str()), slot);
+				index.insert(std::lower_bound(index.begin(), index.end(),
+							entry), entry);
+			}
+		}
+	}
+}
+
+// Blocks keep their binding point across relinks, like uniform slots
+void Shader::reflectBlocks(void) {
+	for (unsigned int i = 0; i < blocks.size(); i++)
+		blocks[i].index = -1;
+
+	GLint count = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (GLint i = 0; i < count; i++) {
+		char name[256];
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(ID, i, sizeof(name), &length, name);
+		unsigned int b = 0;
+		while (b < blocks.size() && blocks[b].name != name)
+			b++;
+		if (b == blocks.size()) {
+			Block block;
+			block.name = name;
+			block.binding = -1;
+			blocks.push_back(block);
+		}
+		blocks[b].index = i;
+		glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_DATA_SIZE,
+				&blocks[b].size);
+		if (blocks[b].binding >= 0)
+			glUniformBlockBinding(ID, i, blocks[b].binding);
+	}
+}
+
+int Shader::addSlot(Uniform_id id, const std::string &name) {
+	int slot = findSlot(id);
+	if (slot >= 0) {
+		if (uniforms[slot].name != name)
+			std::cout << "Uniforms '" << name << "' and '" << uniforms[slot].name
+				<< "' have the same hash" << std::endl;
+		return slot;
+	}
+	Uniform u;
+	u.name = name;
+	u.location = -1;
+	u.type = 0;
+	u.block = -1;
+	u.offset = -1;
+	u.value_size = 0;
+	uniforms.push_back(u);
+	slot = uniforms.size() - 1;
+	std::pair<Uniform_id, int> entry(id, slot);
+	index.insert(std::lower_bound(index.begin(), index.end(), entry), entry);
+	return slot;
+}
+
+int Shader::findSlot(Uniform_id id) const {
+	std::vector<std::pair<Uniform_id, int> >::const_iterator it =
+		std::lower_bound(index.begin(), index.end(),
+				std::pair<Uniform_id, int>(id, -1));
+	return it != index.end() && it->first == id ? it->second : -1;
+}
+
+int Shader::slotOf(const std::string &name) const {
+	int slot = findSlot(uniform_id(name.c_str()));
+	if (slot < 0 && !linking)
+		std::cout << "Uniform '" << name << "' not found" << std::endl;
+	return slot;
+}
+
+int Shader::slotOf(Uniform_id id) const {
+	int slot = findSlot(id);
+	if (slot < 0 && !linking)
+		std::cout << "Uniform 0x" << std::hex << id << std::dec
+			<< " not found" << std::endl;
+	return slot;
+}
+
+/**
+ * False if the uniform already holds `value`: the setter can skip the GL
+ * call. Only with gl_state filtering on, and for uniforms whose value fits
+ * the shadow copy.
+ */
+bool Shader::changed(int slot, const void *value, size_t size) const {
+	if (slot < 0)
+		return true;
+	const Uniform &u = uniforms[slot];
+	Gl_state &state = gl_state();
+	if (state.enabled && u.value_size == size &&
+			memcmp(u.value, value, size) == 0) {
+		state.skipped.uniforms++;
+		return false;
+	}
+	state.issued.uniforms++;
+	if (size <= sizeof(u.value)) {
+		memcpy(u.value, value, size);
+		u.value_size = size;
+	}
+	else
+		u.value_size = 0;
+	return true;
+}
+
+// Values set behind the shadow copies, from `slot` on
+void Shader::forget(int slot, int count) const {
+	gl_state().issued.uniforms++;
+	for (int i = 0; slot >= 0 && i < count && slot + i < (int)uniforms.size();
+			i++)
+		uniforms[slot + i].value_size = 0;
+}
+
+// Samplers and bools are set as ints
+void Shader::checkType(int slot, GLenum expected) const {
+	GLenum type = uniforms[slot].type;
+	bool ok = type == expected;
+	if (expected == GL_INT)
+		ok = type != GL_FLOAT && (type < GL_FLOAT_VEC2 || type > GL_FLOAT_VEC4) &&
+			(type < GL_FLOAT_MAT2 || type > GL_FLOAT_MAT4);
+	if (!ok)
+		std::cout << "Uniform '" << uniforms[slot].name << "' has type 0x"
+			<< std::hex << type << std::dec << ", set as 0x" << std::hex
+			<< expected << std::dec << std::endl;
+}
+
+Shader &ShaderBatch::add(const GLchar *vertexPath, const GLchar *fragmentPath,
+		const Shader_defines &defines) {
+	std::string key = std::string(vertexPath) + "\n" + fragmentPath + "\n";
+	for (unsigned int i = 0; i < defines.size(); i++)
+		key += defines[i].first + "=" + defines[i].second + "\n";
+	std::map<std::string, Shader *>::iterator it = permutations.find(key);
+	if (it != permutations.end())
+		return *it->second;
+
+	shaders.emplace_back(vertexPath, fragmentPath, defines, false);
+	permutations[key] = &shaders.back();
+	return shaders.back();
+}
+
+bool ShaderBatch::ready(void) const {
+	for (std::list<Shader>::const_iterator it = shaders.begin();
+			it != shaders.end(); ++it)
+		if (!it->ready())
+			return false;
+	return true;
+}
+
+// In submission order: while the first one is waited for, the rest go on
+void ShaderBatch::finish(void) {
+	for (std::list<Shader>::iterator it = shaders.begin();
+			it != shaders.end(); ++it)
+		it->finish();
 }
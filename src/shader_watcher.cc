@@ -0,0 +1,99 @@
+#include <shader_watcher.hh>
+#include <iostream>
+#include <algorithm>
+#include <set>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ShaderWatcher::ShaderWatcher() : fd(-1) {
+#ifdef __linux__
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		std::cout << "ShaderWatcher: inotify_init1 failed" << std::endl;
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher() {
+#ifdef __linux__
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+void ShaderWatcher::watch(Shader &shader) {
+	shaders.push_back(&shader);
+	watch_files(shader);
+}
+
+void ShaderWatcher::watch(ShaderBatch &batch) {
+	for (std::list<Shader>::iterator it = batch.begin(); it != batch.end();
+			++it)
+		watch(*it);
+}
+
+int ShaderWatcher::update(void) {
+	std::set<Shader *> changed;
+#ifdef __linux__
+	// Events are packed back to back, each with its name after it
+	char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+	ssize_t bytes;
+	while (fd >= 0 && (bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (char *p = buffer; p < buffer + bytes; ) {
+			const inotify_event *e = (const inotify_event *)p;
+			p += sizeof(inotify_event) + e->len;
+			if (!e->len || !dirs.count(e->wd))
+				continue;
+			std::string path = dirs[e->wd] + e->name;
+			for (unsigned int i = 0; i < shaders.size(); i++)
+				if (uses(*shaders[i], path))
+					changed.insert(shaders[i]);
+		}
+	}
+#endif
+	// Editors write several times per save, each shader compiles once
+	for (std::set<Shader *>::iterator it = changed.begin();
+			it != changed.end(); ++it)
+		(*it)->reload();
+
+	int swapped = 0;
+	for (unsigned int i = 0; i < shaders.size(); i++) {
+		if (!shaders[i]->reloading())
+			continue;
+		if (shaders[i]->swapReloaded() > 0) {
+			std::cout << "Reloaded " << shaders[i]->sources()[0] << std::endl;
+			// Includes may have changed
+			watch_files(*shaders[i]);
+			swapped++;
+		}
+	}
+	return swapped;
+}
+
+// private
+
+void ShaderWatcher::watch_files(const Shader &shader) {
+#ifdef __linux__
+	if (fd < 0)
+		return;
+	const std::vector<std::string> &files = shader.sources();
+	for (unsigned int i = 0; i < files.size(); i++) {
+		// Kept as a prefix, so directory + event name gives back the path
+		// the shader knows the file by
+		std::string dir = files[i].substr(0, files[i].find_last_of('/') + 1);
+		int wd = inotify_add_watch(fd, dir.empty() ? "." : dir.c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0)
+			std::cout << "ShaderWatcher: can't watch '" << dir << "'"
+				<< std::endl;
+		else
+			dirs[wd] = dir;
+	}
+#endif
+}
+
+bool ShaderWatcher::uses(const Shader &shader, const std::string &path) const {
+	const std::vector<std::string> &files = shader.sources();
+	return std::find(files.begin(), files.end(), path) != files.end();
+}
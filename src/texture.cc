@@ -1,37 +1,511 @@
 #include <texture.hh>
+#include <texture_file.hh>
+#include <mipmap.hh>
+#include <gl_ext.hh>
+#include <gl_state.hh>
 #include <stb_image.h>
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool load_image(const std::string &path, bool verticalFlip, Image &img) {
+	// The stb_image flip flag is global, keep it untouched and flip here
+	unsigned char *data = stbi_load(path.c_str(), &img.width, &img.height,
+			&img.channels, 0);
+	if (!data)
+		return false;
+	img.pixels = std::shared_ptr<unsigned char>(data, stbi_image_free);
+
+	if (verticalFlip) {
+		size_t row = img.row_bytes();
+		std::vector<unsigned char> tmp(row);
+		for (int y = 0; y < img.height / 2; y++) {
+			unsigned char *top = data + y * row;
+			unsigned char *bottom = data + (img.height - 1 - y) * row;
+			memcpy(tmp.data(), top, row);
+			memcpy(top, bottom, row);
+			memcpy(bottom, tmp.data(), row);
+		}
+	}
+	return true;
+}
+
+static GLenum pixel_format(int channels) {
+	static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+	return formats[channels - 1];
+}
+
+static bool has_suffix(const std::string &s, const std::string &suffix) {
+	return s.size() >= suffix.size() &&
+		s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void flip_rows(unsigned char *dst, const unsigned char *src,
+		size_t row, int rows) {
+	for (int y = 0; y < rows; y++)
+		memcpy(dst + y * row, src + (rows - 1 - y) * row, row);
+}
+
+// Reverses the first n rows of a BC1 color block
+static void flip_bc1_block(unsigned char *b, int n) {
+	for (int i = 0; i < n / 2; i++) {
+		unsigned char tmp = b[4 + i];
+		b[4 + i] = b[4 + n - 1 - i];
+		b[4 + n - 1 - i] = tmp;
+	}
+}
+
+// Reverses the first n rows of a BC4 block (alpha of BC3, channels of BC5)
+static void flip_bc4_block(unsigned char *b, int n) {
+	uint64_t bits = 0, out = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= (uint64_t)b[2 + i] << (8 * i);
+	out = bits;
+	for (int y = 0; y < n; y++) {
+		uint64_t row = (bits >> (12 * (n - 1 - y))) & 0xFFF;
+		out &= ~((uint64_t)0xFFF << (12 * y));
+		out |= row << (12 * y);
+	}
+	for (int i = 0; i < 6; i++)
+		b[2 + i] = (out >> (8 * i)) & 0xFF;
+}
+
+/**
+ * Flips BC1 / BC3 / BC5 data vertically: block rows are reversed and so are
+ * the pixel rows inside each block. Only exact when the height is a multiple
+ * of 4 or smaller than 4, which holds for power of two mip chains.
+ */
+static bool flip_blocks(unsigned char *dst, const unsigned char *src,
+		int width, int height, unsigned int format) {
+	if (height > 4 && height % 4)
+		return false;
+	size_t block = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+		format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+	size_t row = blocks_x * block;
+	int n = height < 4 ? height : 4;
+	for (int y = 0; y < blocks_y; y++) {
+		unsigned char *d = dst + y * row;
+		memcpy(d, src + (blocks_y - 1 - y) * row, row);
+		for (int x = 0; x < blocks_x; x++) {
+			unsigned char *b = d + x * block;
+			if (block == 8)
+				flip_bc1_block(b, n);
+			else if (format == GL_COMPRESSED_RG_RGTC2) {
+				flip_bc4_block(b, n);
+				flip_bc4_block(b + 8, n);
+			}
+			else {
+				flip_bc4_block(b, n);
+				flip_bc1_block(b + 8, n);
+			}
+		}
+	}
+	return true;
+}
+
+Texture_format choose_texture_format(int channels, Texture_usage usage) {
+	static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+	Texture_format f = {GL_RGBA8, formats[channels - 1], 4,
+		{GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}};
+
+	// No single / dual channel sRGB formats in core GL
+	if (usage == TEXTURE_COLOR_SRGB && channels < 3)
+		usage = TEXTURE_COLOR;
+
+	switch (usage) {
+	case TEXTURE_MASK:
+		f.internal_format = GL_R8;
+		f.texel_bytes = 1;
+		break;
+	case TEXTURE_NORMAL:
+		f.internal_format = GL_RG8;
+		f.texel_bytes = 2;
+		break;
+	case TEXTURE_COLOR_SRGB:
+		// Drivers pad 24 bit formats to 32 bits
+		f.internal_format = channels == 4 ? GL_SRGB8_ALPHA8 : GL_SRGB8;
+		break;
+	case TEXTURE_COLOR:
+		if (channels == 1) {
+			// Grey
+			f.internal_format = GL_R8;
+			f.texel_bytes = 1;
+			f.swizzle[1] = f.swizzle[2] = GL_RED;
+			f.swizzle[3] = GL_ONE;
+		}
+		else if (channels == 2) {
+			// Grey + alpha
+			f.internal_format = GL_RG8;
+			f.texel_bytes = 2;
+			f.swizzle[1] = f.swizzle[2] = GL_RED;
+			f.swizzle[3] = GL_GREEN;
+		}
+		else
+			f.internal_format = channels == 4 ? GL_RGBA8 : GL_RGB8;
+		break;
+	}
+	return f;
+}
+
+static GLenum compressed_format(GLenum format, Texture_usage usage) {
+	if (usage != TEXTURE_COLOR_SRGB)
+		return format;
+	if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+		return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+	if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+	return format;
+}
+
+static int mip_levels(int width, int height) {
+	int levels = 1;
+	while (width > 1 || height > 1) {
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		levels++;
+	}
+	return levels;
+}
+
+static size_t mip_chain_bytes(int width, int height, int levels, int texel_bytes) {
+	size_t bytes = 0;
+	for (int i = 0; i < levels; i++) {
+		bytes += (size_t)width * height * texel_bytes;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return bytes;
+}
+
+size_t Texture2D::total_gpu_bytes = 0;
+Mip_filter Texture2D::mip_filter = MIP_BOX;
 
 Texture2D::Texture2D(const std::string &path, unsigned int location,
-			bool verticalFlip, unsigned int wrapS,
-			unsigned int wrapT) : location(GL_TEXTURE0 + location) {
-	glGenTextures(1, &ID);
-	glBindTexture(GL_TEXTURE_2D, ID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			bool verticalFlip, unsigned int wrapS, unsigned int wrapT,
+			Texture_usage usage) : width(0), height(0), gpu_bytes(0),
+			location(GL_TEXTURE0 + location), channels(0), uploaded(false),
+			immutable(false), usage(usage) {
+	setup(wrapS, wrapT);
 
-	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(verticalFlip);
-	unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-	if (data) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
-				nrChannels == 4 ? GL_RGBA : GL_RGB,
-				GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+	Image img;
+	if (has_suffix(path, TEXTURE_FILE_EXT)) {
+		if (!load_baked(path, verticalFlip))
+			std::cout << "Failed to load texture " << path << std::endl;
+	}
+	else if (load_image(path, verticalFlip, img)) {
+		allocate(img.width, img.height, img.channels);
+		upload_rows(img, 0, img.height);
+		make_mips(img);
 	}
 	else {
 		std::cout << "Failed to load texture " << path << std::endl;
 	}
-	stbi_image_free(data);
+}
+
+Texture2D::Texture2D(const Image &img, unsigned int location,
+			unsigned int wrapS, unsigned int wrapT, Texture_usage usage) :
+			width(0), height(0), gpu_bytes(0), location(GL_TEXTURE0 + location),
+			channels(0), uploaded(false), immutable(false), usage(usage) {
+	setup(wrapS, wrapT);
+	allocate(img.width, img.height, img.channels);
+	upload_rows(img, 0, img.height);
+	make_mips(img);
+}
+
+Texture2D::Texture2D(unsigned int location, unsigned int wrapS,
+			unsigned int wrapT, Texture_usage usage) : width(0), height(0),
+			gpu_bytes(0), location(GL_TEXTURE0 + location), channels(0),
+			uploaded(false), immutable(false), usage(usage) {
+	setup(wrapS, wrapT);
 }
 
 void Texture2D::bind(void) const {
-	glBindTexture(GL_TEXTURE_2D, ID);
+	gl_bind_texture(GL_TEXTURE_2D, ID);
 }
 
 void Texture2D::activateAndBind(void) const {
-	glActiveTexture(location);
-	glBindTexture(GL_TEXTURE_2D, ID);
+	gl_active_texture(location);
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+}
+
+void Texture2D::activateAndBind(unsigned int location) const {
+	gl_active_texture(GL_TEXTURE0 + location);
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+}
+
+void Texture2D::free_gpu(void) {
+	if (ID)
+		gl_delete_textures(1, &ID);
+	ID = 0;
+	set_gpu_bytes(0);
+	uploaded = false;
+}
+
+void Texture2D::allocate(int width, int height, int channels) {
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	Texture_format f = choose_texture_format(channels, usage);
+	int levels = mip_levels(width, height);
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, f.swizzle);
+	immutable = gl_ext().TexStorage2D != NULL;
+	if (immutable)
+		gl_ext().TexStorage2D(GL_TEXTURE_2D, levels, f.internal_format,
+				width, height);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, f.internal_format, width, height, 0,
+				f.format, GL_UNSIGNED_BYTE, NULL);
+	set_gpu_bytes(mip_chain_bytes(width, height, levels, f.texel_bytes));
+}
+
+void Texture2D::upload_rows(const Image &img, int first_row, int rows) {
+	upload_rows(img.pixels.get() + first_row * img.row_bytes(), first_row,
+			rows);
+}
+
+void Texture2D::upload_rows(const unsigned char *pixels, int first_row,
+		int rows) {
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	// RGB rows are not 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, width, rows,
+			pixel_format(channels), GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void Texture2D::finish_upload(void) {
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	use_mips();
+	uploaded = true;
+}
+
+void Texture2D::upload_mips(const std::vector<Mip_level> &levels) {
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int i = 0; i < levels.size(); i++)
+		upload_level(i + 1, levels[i].width, levels[i].height,
+				levels[i].pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	use_mips();
+	uploaded = true;
+}
+
+void Texture2D::upload_mips(const std::vector<Mip_level> &levels,
+		const unsigned char *pixels) {
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int i = 0; i < levels.size(); i++) {
+		const Mip_level &l = levels[i];
+		upload_level(i + 1, l.width, l.height, pixels);
+		pixels += (size_t)l.width * l.height * channels;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	use_mips();
+	uploaded = true;
+}
+
+bool texture_file_map(const std::string &path, Texture_file_map &m) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Texture_file_header)) {
+		close(fd);
+		return false;
+	}
+	size_t file_size = st.st_size;
+	void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	const unsigned char *base = (const unsigned char *)map;
+	const Texture_file_header *h = (const Texture_file_header *)base;
+	const Texture_file_level *levels = (const Texture_file_level *)(h + 1);
+	bool ok = memcmp(h->magic, TEXTURE_FILE_MAGIC, sizeof(h->magic)) == 0 &&
+		h->levels > 0 && sizeof(*h) + h->levels * sizeof(*levels) <= file_size;
+	for (unsigned int i = 0; ok && i < h->levels; i++)
+		ok = levels[i].offset + levels[i].size <= file_size;
+	if (!ok) {
+		munmap(map, file_size);
+		return false;
+	}
+
+	m.data = base;
+	m.size = file_size;
+	m.header = h;
+	m.levels = levels;
+	return true;
+}
+
+void texture_file_unmap(Texture_file_map &m) {
+	if (m.data)
+		munmap((void *)m.data, m.size);
+	m.data = NULL;
+	m.size = 0;
+}
+
+const unsigned char *texture_file_level_data(const Texture_file_map &m,
+		int level, bool verticalFlip, std::vector<unsigned char> &tmp) {
+	const Texture_file_header *h = m.header;
+	// Baked with the other orientation
+	if (verticalFlip == ((h->flags & TEXTURE_FILE_FLIPPED) != 0))
+		return m.data + m.levels[level].offset;
+	tmp.resize(m.levels[level].size);
+	texture_file_copy_level(m, level, verticalFlip, tmp.data());
+	return tmp.data();
+}
+
+void texture_file_copy_level(const Texture_file_map &m, int level,
+		bool verticalFlip, unsigned char *dst) {
+	const Texture_file_header *h = m.header;
+	const Texture_file_level &l = m.levels[level];
+	const unsigned char *data = m.data + l.offset;
+	if (verticalFlip == ((h->flags & TEXTURE_FILE_FLIPPED) != 0))
+		memcpy(dst, data, l.size);
+	else if (h->format != 0)
+		flip_rows(dst, data, l.size / l.height, l.height);
+	else if (!flip_blocks(dst, data, l.width, l.height, h->internal_format))
+		std::cout << "Can't flip level " << level << " of a "
+			<< h->width << "x" << h->height << " texture" << std::endl;
+}
+
+GLenum texture_file_internal_format(const Texture_file_header *h,
+		Texture_usage usage) {
+	// Raw levels follow the usage, like decoded images
+	if (h->format != 0)
+		return choose_texture_format(h->channels, usage).internal_format;
+	return compressed_format(h->internal_format, usage);
+}
+
+size_t texture_file_level_bytes(const Texture_file_map &m, int level,
+		Texture_usage usage) {
+	const Texture_file_level &l = m.levels[level];
+	if (m.header->format == 0)
+		return l.size;
+	return (size_t)l.width * l.height *
+		choose_texture_format(m.header->channels, usage).texel_bytes;
+}
+
+void texture_file_upload_level(const Texture_file_map &m, int level,
+		const unsigned char *data, GLenum internal_format, bool immutable) {
+	const Texture_file_header *h = m.header;
+	const Texture_file_level &l = m.levels[level];
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (h->format == 0 && immutable)
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, l.width,
+				l.height, internal_format, l.size, data);
+	else if (h->format == 0)
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format,
+				l.width, l.height, 0, l.size, data);
+	else if (immutable)
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, l.width, l.height,
+				h->format, h->type, data);
+	else
+		glTexImage2D(GL_TEXTURE_2D, level, internal_format, l.width,
+				l.height, 0, h->format, h->type, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void texture_file_check_support(const Texture_file_map &m,
+		const std::string &path) {
+	const Texture_file_header *h = m.header;
+	if (h->format == 0 && h->internal_format != GL_COMPRESSED_RG_RGTC2) {
+		static bool s3tc = gl_has_extension("GL_EXT_texture_compression_s3tc");
+		if (!s3tc)
+			std::cout << path << ": driver lacks S3TC (BC1/BC3)" << std::endl;
+	}
+}
+
+// private
+bool Texture2D::load_baked(const std::string &path, bool verticalFlip) {
+	Texture_file_map m;
+	if (!texture_file_map(path, m))
+		return false;
+	texture_file_check_support(m, path);
+
+	const Texture_file_header *h = m.header;
+	width = h->width;
+	height = h->height;
+	channels = h->channels;
+
+	GLenum internal_format = texture_file_internal_format(h, usage);
+	immutable = gl_ext().TexStorage2D != NULL;
+	size_t bytes = 0;
+
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, h->levels - 1);
+	if (h->format != 0)
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+				choose_texture_format(channels, usage).swizzle);
+	if (immutable)
+		gl_ext().TexStorage2D(GL_TEXTURE_2D, h->levels, internal_format,
+				width, height);
+	std::vector<unsigned char> tmp;
+	for (unsigned int i = 0; i < h->levels; i++) {
+		const unsigned char *data = texture_file_level_data(m, i,
+				verticalFlip, tmp);
+		texture_file_upload_level(m, i, data, internal_format, immutable);
+		bytes += texture_file_level_bytes(m, i, usage);
+	}
+	set_gpu_bytes(bytes);
+	if (h->levels > 1)
+		use_mips();
+
+	texture_file_unmap(m);
+	uploaded = true;
+	return true;
+}
+
+void Texture2D::make_mips(const Image &img) {
+	if (mip_filter == MIP_DRIVER) {
+		finish_upload();
+		return;
+	}
+	std::vector<Mip_level> levels;
+	mip_generate(img.pixels.get(), img.width, img.height, img.channels,
+			levels, mip_filter, usage);
+	upload_mips(levels);
+}
+
+void Texture2D::set_gpu_bytes(size_t bytes) {
+	total_gpu_bytes += bytes;
+	total_gpu_bytes -= gpu_bytes;
+	gpu_bytes = bytes;
+}
+
+void Texture2D::setup(unsigned int wrapS, unsigned int wrapT) {
+	glGenTextures(1, &ID);
+	gl_bind_texture(GL_TEXTURE_2D, ID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Bound texture, once its chain is complete: until then it samples level 0
+void Texture2D::use_mips(void) {
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+}
+
+// Bound texture, unpack alignment already 1
+void Texture2D::upload_level(int level, int width, int height,
+		const unsigned char *pixels) {
+	Texture_format f = choose_texture_format(channels, usage);
+	if (immutable)
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, f.format,
+				GL_UNSIGNED_BYTE, pixels);
+	else
+		glTexImage2D(GL_TEXTURE_2D, level, f.internal_format, width, height,
+				0, f.format, GL_UNSIGNED_BYTE, pixels);
 }
@@ -0,0 +1,204 @@
+#include <texture_array.hh>
+#include <gl_ext.hh>
+#include <gl_state.hh>
+#include <iostream>
+#include <cstring>
+
+static int align(int v, int a) {
+	return (v + a - 1) / a * a;
+}
+
+static int log2i(int v) {
+	int l = 0;
+	while (v > 1) {
+		v /= 2;
+		l++;
+	}
+	return l;
+}
+
+TextureArray::TextureArray(int width, int height, unsigned int location,
+		int padding, Texture_usage usage) : width(width), height(height),
+		gpu_bytes(0), location(GL_TEXTURE0 + location), usage(usage),
+		packed(false) {
+	// Power of two, so mip levels up to log2(padding) stay aligned
+	this->padding = 1;
+	while (this->padding * 2 <= padding)
+		this->padding *= 2;
+
+	glGenTextures(1, &ID);
+	gl_bind_texture(GL_TEXTURE_2D_ARRAY, ID);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+			GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+int TextureArray::add(const Image &img) {
+	Texture_slot s;
+	int x, y;
+	if (img.width == width && img.height == height) {
+		s.layer = new_page();
+		page_top[s.layer] = height; // Full, no shelves here
+		blit(img, s.layer, 0, 0, 0);
+		s.u = s.v = 0.0f;
+		s.width = s.height = 1.0f;
+	}
+	else if (place(img.width, img.height, s.layer, x, y)) {
+		blit(img, s.layer, x, y, padding);
+		s.u = (float)(x + padding) / width;
+		s.v = (float)(y + padding) / height;
+		s.width = (float)img.width / width;
+		s.height = (float)img.height / height;
+		packed = true;
+	}
+	else {
+		std::cout << "TextureArray: " << img.width << "x" << img.height
+			<< " image doesn't fit in a " << width << "x" << height
+			<< " layer" << std::endl;
+		return -1;
+	}
+	slots.push_back(s);
+	return slots.size() - 1;
+}
+
+int TextureArray::add(const std::string &path, bool verticalFlip) {
+	Image img;
+	if (!load_image(path, verticalFlip, img)) {
+		std::cout << "Failed to load texture " << path << std::endl;
+		return -1;
+	}
+	return add(img);
+}
+
+int TextureArray::add_color(float r, float g, float b, float a) {
+	float c[4] = {r, g, b, a};
+	Image img;
+	img.width = img.height = 4;
+	img.channels = 4;
+	img.pixels = std::shared_ptr<unsigned char>(new unsigned char[4 * 4 * 4],
+			std::default_delete<unsigned char[]>());
+	for (int i = 0; i < 4 * 4 * 4; i++)
+		img.pixels.get()[i] = (unsigned char)(c[i % 4] * 255.0f + 0.5f);
+	return add(img);
+}
+
+void TextureArray::build(void) {
+	Texture_format f = choose_texture_format(4, usage);
+	int levels = log2i(width > height ? width : height) + 1;
+	if (packed && log2i(padding) + 1 < levels)
+		levels = log2i(padding) + 1;
+
+	gl_bind_texture(GL_TEXTURE_2D_ARRAY, ID);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, f.swizzle);
+	if (gl_ext().TexStorage3D)
+		gl_ext().TexStorage3D(GL_TEXTURE_2D_ARRAY, levels, f.internal_format,
+				width, height, pages.size());
+	else
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, f.internal_format, width, height,
+				pages.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	for (unsigned int i = 0; i < pages.size(); i++)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, pages[i].data());
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	gpu_bytes = 0;
+	for (int i = 0, w = width, h = height; i < levels; i++) {
+		gpu_bytes += (size_t)w * h * f.texel_bytes * pages.size();
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+
+	// Keep the layout, the pixels live on the GPU now
+	for (unsigned int i = 0; i < pages.size(); i++)
+		std::vector<unsigned char>().swap(pages[i]);
+}
+
+void TextureArray::bind(void) const {
+	gl_bind_texture(GL_TEXTURE_2D_ARRAY, ID);
+}
+
+void TextureArray::activateAndBind(void) const {
+	gl_active_texture(location);
+	gl_bind_texture(GL_TEXTURE_2D_ARRAY, ID);
+}
+
+void TextureArray::free_gpu(void) {
+	if (ID)
+		gl_delete_textures(1, &ID);
+	ID = 0;
+	gpu_bytes = 0;
+}
+
+// private
+int TextureArray::new_page(void) {
+	pages.push_back(std::vector<unsigned char>((size_t)width * height * 4));
+	page_top.push_back(0);
+	return pages.size() - 1;
+}
+
+// Shelf packing: the lowest shelf that is tall enough and has room, or a new
+// shelf on top of the last layer, or a new layer
+bool TextureArray::place(int w, int h, int &layer, int &x, int &y) {
+	w = align(w + 2 * padding, padding);
+	h = align(h + 2 * padding, padding);
+	if (w > width || h > height)
+		return false;
+
+	Shelf *best = NULL;
+	for (unsigned int i = 0; i < shelves.size(); i++) {
+		Shelf &s = shelves[i];
+		if (s.height >= h && s.x + w <= width &&
+				(!best || s.height < best->height))
+			best = &s;
+	}
+	if (!best) {
+		Shelf s;
+		s.layer = -1;
+		for (int i = pages.size() - 1; i >= 0; i--)
+			if (page_top[i] + h <= height) {
+				s.layer = i;
+				break;
+			}
+		if (s.layer < 0)
+			s.layer = new_page();
+		s.y = page_top[s.layer];
+		s.height = h;
+		s.x = 0;
+		page_top[s.layer] += h;
+		shelves.push_back(s);
+		best = &shelves.back();
+	}
+
+	layer = best->layer;
+	x = best->x;
+	y = best->y;
+	best->x += w;
+	return true;
+}
+
+// Copies the image at (x + pad, y + pad), the border wraps around
+void TextureArray::blit(const Image &img, int layer, int x, int y, int pad) {
+	unsigned char *page = pages[layer].data();
+	const unsigned char *src = img.pixels.get();
+	for (int py = -pad; py < img.height + pad; py++) {
+		int sy = (py + img.height * pad) % img.height;
+		unsigned char *dst = page + ((size_t)(y + pad + py) * width + x) * 4;
+		for (int px = -pad; px < img.width + pad; px++) {
+			int sx = (px + img.width * pad) % img.width;
+			const unsigned char *p = src + (size_t)sy * img.row_bytes() +
+				sx * img.channels;
+			unsigned char *o = dst + (pad + px) * 4;
+			// Same layout the format policy swizzles to
+			switch (img.channels) {
+			case 1: o[0] = o[1] = o[2] = p[0]; o[3] = 255; break;
+			case 2: o[0] = o[1] = o[2] = p[0]; o[3] = p[1]; break;
+			case 3: o[0] = p[0]; o[1] = p[1]; o[2] = p[2]; o[3] = 255; break;
+			default: memcpy(o, p, 4); break;
+			}
+		}
+	}
+}
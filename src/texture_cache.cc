@@ -0,0 +1,93 @@
+#include <texture_cache.hh>
+#include <iostream>
+
+static void delete_texture(Texture2D *t) {
+	t->free_gpu();
+	delete t;
+}
+
+Texture_handle make_texture_handle(Texture2D *t) {
+	return Texture_handle(t, delete_texture);
+}
+
+TextureCache::TextureCache(size_t budget_bytes) : hits(0), misses(0),
+		evictions(0), budget_bytes(budget_bytes), resident(0) {}
+
+TextureCache::~TextureCache() {
+	// Handles still held by the user keep their textures alive
+	lru.clear();
+	entries.clear();
+}
+
+Texture_handle TextureCache::load(const std::string &path,
+		unsigned int location, bool verticalFlip, unsigned int wrapS,
+		unsigned int wrapT, Texture_usage usage) {
+	std::string key = make_key(path, verticalFlip, wrapS, wrapT, usage);
+	auto found = entries.find(key);
+	if (found != entries.end()) {
+		// Move to the front of the LRU list
+		lru.splice(lru.begin(), lru, found->second);
+		hits++;
+		return found->second->texture;
+	}
+
+	misses++;
+	Entry e;
+	e.key = key;
+	e.texture = make_texture_handle(new Texture2D(path, location,
+				verticalFlip, wrapS, wrapT, usage));
+	lru.push_front(e);
+	entries[key] = lru.begin();
+	resident += e.texture->gpu_bytes;
+	trim();
+	return e.texture;
+}
+
+void TextureCache::set_budget(size_t bytes) {
+	budget_bytes = bytes;
+	trim();
+}
+
+void TextureCache::trim(void) {
+	auto it = lru.end();
+	while (resident > budget_bytes && it != lru.begin()) {
+		--it;
+		// Only the cache holds this one
+		if (it->texture.use_count() == 1) {
+			auto victim = it++;
+			evict(victim);
+		}
+	}
+}
+
+void TextureCache::clear_unused(void) {
+	for (auto it = lru.begin(); it != lru.end();) {
+		auto next = it;
+		++next;
+		if (it->texture.use_count() == 1)
+			evict(it);
+		it = next;
+	}
+}
+
+void TextureCache::print_stats(std::ostream &out) const {
+	out << "TextureCache: " << entries.size() << " textures, "
+		<< resident / 1024 << " KiB resident (budget "
+		<< budget_bytes / 1024 << " KiB), " << hits << " hits, "
+		<< misses << " misses, " << evictions << " evictions" << std::endl;
+}
+
+// private
+void TextureCache::evict(Lru_list::iterator it) {
+	resident -= it->texture->gpu_bytes;
+	entries.erase(it->key);
+	lru.erase(it);
+	evictions++;
+}
+
+std::string TextureCache::make_key(const std::string &path, bool verticalFlip,
+		unsigned int wrapS, unsigned int wrapT, Texture_usage usage) {
+	return path + '|' + (verticalFlip ? '1' : '0') + '|' +
+		std::to_string(wrapS) + '|' + std::to_string(wrapT) + '|' +
+		std::to_string(usage);
+}
@@ -0,0 +1,291 @@
+#include <texture_streamer.hh>
+#include <gl_state.hh>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+
+// Frames a texture may go unused before it's the first to lose levels
+#define STREAM_KEEP_FRAMES 120
+
+static bool has_suffix(const std::string &s, const std::string &suffix) {
+	return s.size() >= suffix.size() &&
+		s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// "dir/stones.jpg" -> "dir/stones.ktex"
+static std::string baked_path(const std::string &path) {
+	size_t dot = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + TEXTURE_FILE_EXT;
+	return path.substr(0, dot) + TEXTURE_FILE_EXT;
+}
+
+TextureStreamer::TextureStreamer(size_t budget_bytes, int min_size,
+		unsigned int threads, UploadRing *ring) : streamed_in(0), dropped(0),
+		budget_bytes(budget_bytes), min_size(min_size), frame(0), ring(ring),
+		quit(false) {
+	if (threads == 0)
+		threads = 1;
+	for (unsigned int i=0; i<threads; i++)
+		workers.push_back(std::thread(&TextureStreamer::worker, this));
+}
+
+TextureStreamer::~TextureStreamer() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	work_cv.notify_all();
+	for (unsigned int i=0; i<workers.size(); i++)
+		workers[i].join();
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		texture_file_unmap(it->map);
+}
+
+Texture_handle TextureStreamer::load(const std::string &path,
+		unsigned int location, bool verticalFlip, unsigned int wrapS,
+		unsigned int wrapT, Texture_usage usage) {
+	std::string file = path;
+	if (!has_suffix(path, TEXTURE_FILE_EXT) &&
+			access(baked_path(path).c_str(), R_OK) == 0)
+		file = baked_path(path);
+
+	Entry e;
+	if (!has_suffix(file, TEXTURE_FILE_EXT) || !texture_file_map(file, e.map)) {
+		Texture_handle t = make_texture_handle(new Texture2D(path, location,
+					verticalFlip, wrapS, wrapT, usage));
+		pinned.push_back(t);
+		return t;
+	}
+	texture_file_check_support(e.map, file);
+
+	const Texture_file_header *h = e.map.header;
+	e.texture = make_texture_handle(new Texture2D(location, wrapS, wrapT, usage));
+	e.flip = verticalFlip;
+	e.internal_format = texture_file_internal_format(h, usage);
+	e.levels = h->levels;
+	e.loading = -1;
+	e.last_used = frame;
+
+	e.bytes_from.resize(e.levels + 1);
+	e.bytes_from[e.levels] = 0;
+	for (int i = e.levels - 1; i >= 0; i--)
+		e.bytes_from[i] = e.bytes_from[i + 1] +
+			texture_file_level_bytes(e.map, i, usage);
+
+	// Small levels go up right away
+	e.min_level = e.levels - 1;
+	while (e.min_level > 0 &&
+			(int)e.map.levels[e.min_level - 1].width <= min_size &&
+			(int)e.map.levels[e.min_level - 1].height <= min_size)
+		e.min_level--;
+	e.top = e.levels;
+	e.target = e.wanted = e.min_level;
+
+	Texture2D *t = e.texture.get();
+	t->width = h->width;
+	t->height = h->height;
+	t->channels = h->channels;
+	gl_bind_texture(GL_TEXTURE_2D, t->ID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, e.levels - 1);
+	if (h->format != 0)
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+				choose_texture_format(h->channels, usage).swizzle);
+
+	entries.push_back(e);
+	Entry &added = entries.back();
+	std::vector<unsigned char> tmp;
+	for (int i = e.levels - 1; i >= e.min_level; i--)
+		upload_level(added, i, texture_file_level_data(added.map, i,
+					added.flip, tmp));
+	t->uploaded = true;
+	by_texture[t] = &added;
+	return added.texture;
+}
+
+void TextureStreamer::use(const Texture_handle &t, float uv_scale,
+		float distance, float pixels_per_unit) {
+	auto found = by_texture.find(t.get());
+	if (found == by_texture.end() || uv_scale <= 0.0f || pixels_per_unit <= 0.0f)
+		return;
+	Entry &e = *found->second;
+
+	// Texels of level 0 under one pixel
+	int size = std::max(t->width, t->height);
+	float texels = size * distance / (pixels_per_unit * uv_scale);
+	int level = texels > 1.0f ? (int)std::floor(std::log2(texels)) : 0;
+	if (level < e.wanted)
+		e.wanted = level;
+	e.last_used = frame;
+}
+
+void TextureStreamer::update(size_t budget_bytes) {
+	if (ring)
+		ring->update();
+
+	// Targets from this frame's uses, kept for a while after the last one
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		Entry &e = *it;
+		if (e.last_used == frame)
+			e.target = e.wanted;
+		else if (frame - e.last_used > STREAM_KEEP_FRAMES)
+			e.target = e.min_level;
+		e.wanted = e.min_level;
+	}
+	fit_budget();
+
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		Entry &e = *it;
+		if (e.target > e.top)
+			drop_levels(e, e.target);
+		else if (e.target < e.top && e.loading < 0) {
+			// One level at a time, coarse to fine
+			Job j;
+			j.entry = &e;
+			j.level = e.top - 1;
+			j.slot = -1;
+			e.loading = j.level;
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(std::move(j));
+			work_cv.notify_one();
+		}
+	}
+
+	size_t sent = 0;
+	while (sent < budget_bytes) {
+		Job j;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (done.empty())
+				break;
+			j = std::move(done.front());
+			done.pop_front();
+		}
+		Entry &e = *j.entry;
+		e.loading = -1;
+		// Still the next level and still wanted
+		if (j.level != e.top - 1 || j.level < e.target) {
+			if (j.slot >= 0)
+				ring->release(j.slot);
+			continue;
+		}
+		if (j.slot >= 0) {
+			upload_level(e, j.level, ring->bind(j.slot));
+			ring->unbind();
+			ring->release(j.slot);
+		}
+		else
+			upload_level(e, j.level, j.data.data());
+		sent += e.map.levels[j.level].size;
+		streamed_in++;
+	}
+	frame++;
+}
+
+size_t TextureStreamer::resident_bytes(void) const {
+	size_t bytes = 0;
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		bytes += it->bytes_from[it->top];
+	for (unsigned int i = 0; i < pinned.size(); i++)
+		bytes += pinned[i]->gpu_bytes;
+	return bytes;
+}
+
+void TextureStreamer::print_stats(std::ostream &out) const {
+	out << "TextureStreamer: " << entries.size() << " streamed, "
+		<< pinned.size() << " pinned, " << resident_bytes() / 1024
+		<< " KiB resident (budget " << budget_bytes / 1024 << " KiB), "
+		<< streamed_in << " levels streamed in, " << dropped << " dropped"
+		<< std::endl;
+}
+
+// private
+
+/**
+ * Coarsens targets until they fit. Textures unused for the longest lose
+ * levels first, and among those the ones whose finest level costs the most.
+ * Small levels always stay, even over budget.
+ */
+void TextureStreamer::fit_budget(void) {
+	size_t total = 0;
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		total += it->bytes_from[it->target];
+	for (unsigned int i = 0; i < pinned.size(); i++)
+		total += pinned[i]->gpu_bytes;
+
+	while (total > budget_bytes) {
+		Entry *victim = NULL;
+		size_t victim_bytes = 0;
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			Entry &e = *it;
+			if (e.target >= e.min_level)
+				continue;
+			size_t bytes = e.bytes_from[e.target] - e.bytes_from[e.target + 1];
+			if (!victim || e.last_used < victim->last_used ||
+					(e.last_used == victim->last_used && bytes > victim_bytes)) {
+				victim = &e;
+				victim_bytes = bytes;
+			}
+		}
+		if (!victim)
+			break;
+		victim->target++;
+		total -= victim_bytes;
+	}
+}
+
+void TextureStreamer::drop_levels(Entry &e, int level) {
+	gl_bind_texture(GL_TEXTURE_2D, e.texture->ID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	// Levels below the base don't count for completeness, empty them
+	for (int i = e.top; i < level; i++) {
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, 0, 0, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, NULL);
+		dropped++;
+	}
+	e.top = level;
+	e.texture->set_gpu_bytes(e.bytes_from[e.top]);
+}
+
+void TextureStreamer::upload_level(Entry &e, int level,
+		const unsigned char *data) {
+	gl_bind_texture(GL_TEXTURE_2D, e.texture->ID);
+	texture_file_upload_level(e.map, level, data, e.internal_format, false);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	e.top = level;
+	e.texture->set_gpu_bytes(e.bytes_from[e.top]);
+}
+
+// Reads (and flips) levels, faulting the mapped pages in off the GL thread.
+// Writes them to the upload ring when it has room.
+void TextureStreamer::worker(void) {
+	std::vector<unsigned char> tmp;
+	for (;;) {
+		Job j;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_cv.wait(lock, [this] { return quit || !queue.empty(); });
+			if (quit)
+				return;
+			j = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		const Entry &e = *j.entry;
+		const Texture_file_level &l = e.map.levels[j.level];
+		unsigned char *dst;
+		if (ring && (j.slot = ring->acquire(l.size, dst)) >= 0)
+			texture_file_copy_level(e.map, j.level, e.flip, dst);
+		else {
+			const unsigned char *data = texture_file_level_data(e.map,
+					j.level, e.flip, tmp);
+			j.data.assign(data, data + l.size);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		done.push_back(std::move(j));
+	}
+}
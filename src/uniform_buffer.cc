@@ -0,0 +1,34 @@
+#include <uniform_buffer.hh>
+#include <iostream>
+
+UniformBuffer::UniformBuffer(size_t bytes, unsigned int binding,
+		GLenum usage, const void *data) : bytes(bytes),
+		binding_point(binding), usage(usage) {
+	glGenBuffers(1, &ID);
+	glBindBuffer(GL_UNIFORM_BUFFER, ID);
+	glBufferData(GL_UNIFORM_BUFFER, bytes, data, usage);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	bind();
+}
+
+UniformBuffer::~UniformBuffer() {
+	glDeleteBuffers(1, &ID);
+}
+
+void UniformBuffer::set(const void *data, size_t size, size_t offset) {
+	if (offset + size > bytes) {
+		std::cout << "UniformBuffer: " << size << " bytes at " << offset
+			<< " don't fit in " << bytes << std::endl;
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, ID);
+	if (offset == 0 && size == bytes)
+		glBufferData(GL_UNIFORM_BUFFER, bytes, data, usage);
+	else
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffer::bind(void) const {
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding_point, ID);
+}
@@ -0,0 +1,121 @@
+#include <upload_ring.hh>
+#include <gl_ext.hh>
+#include <iostream>
+
+UploadRing::UploadRing(size_t slot_bytes, unsigned int count) : acquired(0),
+		missed(0), slot_bytes(slot_bytes) {
+	is_persistent = gl_ext().BufferStorage != NULL;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+		GL_MAP_COHERENT_BIT;
+
+	slots.resize(count);
+	for (unsigned int i = 0; i < count; i++) {
+		Slot &s = slots[i];
+		s.memory = NULL;
+		s.fence = 0;
+		s.state = SLOT_UNMAPPED;
+		glGenBuffers(1, &s.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+		if (is_persistent) {
+			gl_ext().BufferStorage(GL_PIXEL_UNPACK_BUFFER, slot_bytes, NULL,
+					flags);
+			s.memory = (unsigned char *)glMapBufferRange(
+					GL_PIXEL_UNPACK_BUFFER, 0, slot_bytes, flags);
+			if (s.memory)
+				s.state = SLOT_FREE;
+			else
+				std::cout << "Failed to map upload buffer " << i << std::endl;
+		}
+		else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_bytes, NULL,
+					GL_STREAM_DRAW);
+			map(s);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+UploadRing::~UploadRing() {
+	for (unsigned int i = 0; i < slots.size(); i++) {
+		if (slots[i].fence)
+			glDeleteSync(slots[i].fence);
+		// Deleting a mapped buffer unmaps it
+		glDeleteBuffers(1, &slots[i].buffer);
+	}
+}
+
+int UploadRing::acquire(size_t bytes, unsigned char *&memory) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (bytes <= slot_bytes) {
+		for (unsigned int i = 0; i < slots.size(); i++) {
+			if (slots[i].state != SLOT_FREE)
+				continue;
+			slots[i].state = SLOT_WRITING;
+			memory = slots[i].memory;
+			acquired++;
+			return i;
+		}
+	}
+	missed++;
+	return -1;
+}
+
+const unsigned char *UploadRing::bind(int slot) {
+	Slot &s = slots[slot];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+	std::lock_guard<std::mutex> lock(mutex);
+	// The worker is done writing, a plain mapping has to go before the GL
+	// reads from the buffer
+	if (s.state == SLOT_WRITING && !is_persistent) {
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		s.memory = NULL;
+	}
+	s.state = SLOT_BOUND;
+	return (const unsigned char *)NULL;
+}
+
+void UploadRing::unbind(void) {
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void UploadRing::release(int slot) {
+	Slot &s = slots[slot];
+	std::lock_guard<std::mutex> lock(mutex);
+	if (s.state == SLOT_WRITING) {
+		// Never read by the GL, still mapped
+		s.state = SLOT_FREE;
+		return;
+	}
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s.state = SLOT_FENCED;
+}
+
+void UploadRing::update(void) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unsigned int i = 0; i < slots.size(); i++) {
+		Slot &s = slots[i];
+		if (s.state == SLOT_FENCED) {
+			GLenum r = glClientWaitSync(s.fence, 0, 0);
+			if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(s.fence);
+			s.fence = 0;
+			s.state = is_persistent ? SLOT_FREE : SLOT_UNMAPPED;
+		}
+		if (s.state == SLOT_UNMAPPED && !is_persistent) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+			map(s);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+}
+
+// private
+
+// The buffer is bound to GL_PIXEL_UNPACK_BUFFER and the GPU is done with it
+void UploadRing::map(Slot &s) {
+	s.memory = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+			slot_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+			GL_MAP_UNSYNCHRONIZED_BIT);
+	s.state = s.memory ? SLOT_FREE : SLOT_UNMAPPED;
+}
@@ -0,0 +1,228 @@
+/**
+ * texbake - bakes images into .ktex files (see inc/texture_file.hh)
+ *
+ * Usage: texbake [--no-flip] [--kaiser] [--normal]
+ *                [--bc | --bc1 | --bc3 | --bc5] input [output]
+ *        texbake --bench input
+ *
+ * The output defaults to the input name with the extension replaced by
+ * .ktex. Images are flipped vertically by default, matching the Texture2D
+ * default. Loading a .ktex with a different verticalFlip still works, the
+ * rows are flipped while uploading.
+ *
+ * Mip levels are filtered in linear light (see mipmap.hh) with a box filter,
+ * or a Kaiser filter with --kaiser. --normal renormalizes the levels of
+ * normal maps instead.
+ *
+ * --bc picks BC3 for images with alpha and BC1 otherwise. Use --bc5 for
+ * normal maps (shaders rebuild Z from X and Y), it implies --normal.
+ *
+ * --bench times the mip generator and encodes the image in every format,
+ * printing MPixels/s. mipbench compares the mip generator with the driver.
+ */
+#include <glad/glad.h>
+#include <texture.hh>
+#include <texture_file.hh>
+#include <bc_encoder.hh>
+#include <mipmap.hh>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+enum Output_format {
+	RAW,
+	AUTO_BC,
+	COMPRESS_BC1,
+	COMPRESS_BC3,
+	COMPRESS_BC5,
+};
+
+// Replaces the pixels of every level with its blocks
+static void compress(std::vector<Mip_level> &levels, int channels, Bc_format fmt) {
+	for (unsigned int i = 0; i < levels.size(); i++) {
+		std::vector<unsigned char> blocks;
+		bc_encode(fmt, levels[i].pixels.data(), levels[i].width,
+				levels[i].height, channels, blocks);
+		levels[i].pixels.swap(blocks);
+	}
+}
+
+static bool write_file(const std::string &path, const std::vector<Mip_level> &levels,
+		int channels, bool flipped, Output_format out_format) {
+	Texture_file_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TEXTURE_FILE_MAGIC, sizeof(h.magic));
+	if (out_format == RAW) {
+		static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+		h.internal_format = GL_RGBA8;
+		h.format = formats[channels - 1];
+		h.type = GL_UNSIGNED_BYTE;
+	}
+	else {
+		h.internal_format = bc_gl_format(out_format == COMPRESS_BC1 ? BC1 :
+				out_format == COMPRESS_BC3 ? BC3 : BC5);
+	}
+	h.width = levels[0].width;
+	h.height = levels[0].height;
+	h.channels = channels;
+	h.levels = levels.size();
+	h.flags = flipped ? TEXTURE_FILE_FLIPPED : 0;
+
+	std::vector<Texture_file_level> table(levels.size());
+	uint64_t offset = sizeof(h) + table.size() * sizeof(Texture_file_level);
+	for (unsigned int i = 0; i < levels.size(); i++) {
+		table[i].width = levels[i].width;
+		table[i].height = levels[i].height;
+		table[i].offset = offset;
+		table[i].size = levels[i].pixels.size();
+		offset += (table[i].size + 3) & ~(uint64_t)3; // Keep levels aligned
+	}
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	if (!out)
+		return false;
+	out.write((const char *)&h, sizeof(h));
+	out.write((const char *)table.data(), table.size() * sizeof(table[0]));
+	for (unsigned int i = 0; i < levels.size(); i++) {
+		static const char pad[4] = {0, 0, 0, 0};
+		out.write((const char *)levels[i].pixels.data(), levels[i].pixels.size());
+		out.write(pad, ((table[i].size + 3) & ~(uint64_t)3) - table[i].size);
+	}
+	return out.good();
+}
+
+static std::string default_output(const std::string &input) {
+	size_t dot = input.rfind('.');
+	size_t slash = input.rfind('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return input + TEXTURE_FILE_EXT;
+	return input.substr(0, dot) + TEXTURE_FILE_EXT;
+}
+
+static void usage(void) {
+	std::cout << "Usage: texbake [--no-flip] [--kaiser] [--normal] "
+		"[--bc | --bc1 | --bc3 | --bc5] input [output]" << std::endl;
+	std::cout << "       texbake --bench input" << std::endl;
+}
+
+static void bench(const Image &img) {
+	const char *names[] = {"BC1", "BC3", "BC5"};
+	const char *filters[] = {"", "box", "kaiser"};
+	const int runs = 5;
+	double mpixels = (double)img.width * img.height / 1e6;
+	unsigned int cores = std::thread::hardware_concurrency();
+	std::cout << img.width << "x" << img.height << ", " << img.channels
+		<< " channels, " << cores << " threads, " << mip_isa() << std::endl;
+	std::vector<unsigned int> counts(1, 1);
+	if (cores > 1)
+		counts.push_back(cores);
+
+	for (int f = MIP_BOX; f <= MIP_KAISER; f++) {
+		std::vector<Mip_level> levels;
+		for (unsigned int c = 0; c < counts.size(); c++) {
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < runs; i++)
+				mip_generate(img.pixels.get(), img.width, img.height,
+						img.channels, levels, (Mip_filter)f, TEXTURE_COLOR,
+						counts[c]);
+			std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+			std::cout << "mips " << filters[f] << " " << counts[c]
+				<< " thread(s): " << t.count() * 1000.0 / runs << " ms, "
+				<< mpixels * runs / t.count() << " MPixels/s" << std::endl;
+		}
+	}
+
+	for (int f = BC1; f <= BC5; f++) {
+		std::vector<unsigned char> out;
+		bc_encode((Bc_format)f, img.pixels.get(), img.width, img.height,
+				img.channels, out); // warm up
+		for (unsigned int c = 0; c < counts.size(); c++) {
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < runs; i++)
+				bc_encode((Bc_format)f, img.pixels.get(), img.width, img.height,
+						img.channels, out, counts[c]);
+			std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+			std::cout << names[f] << " " << counts[c] << " thread(s): "
+				<< mpixels * runs / t.count() << " MPixels/s" << std::endl;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	bool flip = true;
+	bool run_bench = false;
+	Mip_filter filter = MIP_BOX;
+	Texture_usage tex_usage = TEXTURE_COLOR;
+	Output_format out_format = RAW;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		std::string a = argv[i];
+		if (a == "--no-flip")
+			flip = false;
+		else if (a == "--bench")
+			run_bench = true;
+		else if (a == "--kaiser")
+			filter = MIP_KAISER;
+		else if (a == "--normal")
+			tex_usage = TEXTURE_NORMAL;
+		else if (a == "--bc")
+			out_format = AUTO_BC;
+		else if (a == "--bc1")
+			out_format = COMPRESS_BC1;
+		else if (a == "--bc3")
+			out_format = COMPRESS_BC3;
+		else if (a == "--bc5")
+			out_format = COMPRESS_BC5;
+		else if (a == "-h" || a == "--help") {
+			usage();
+			return 0;
+		}
+		else
+			files.push_back(a);
+	}
+	if (files.empty() || files.size() > 2) {
+		usage();
+		return 1;
+	}
+	std::string output = files.size() == 2 ? files[1] : default_output(files[0]);
+
+	Image img;
+	if (!load_image(files[0], flip, img)) {
+		std::cout << "Failed to load " << files[0] << std::endl;
+		return 1;
+	}
+	if (run_bench) {
+		bench(img);
+		return 0;
+	}
+	if (out_format == AUTO_BC)
+		out_format = img.channels == 4 ? COMPRESS_BC3 : COMPRESS_BC1;
+	if (out_format == COMPRESS_BC5)
+		tex_usage = TEXTURE_NORMAL;
+
+	std::vector<Mip_level> mips;
+	mip_generate(img.pixels.get(), img.width, img.height, img.channels, mips,
+			filter, tex_usage);
+	std::vector<Mip_level> levels(1);
+	levels[0].width = img.width;
+	levels[0].height = img.height;
+	levels[0].pixels.assign(img.pixels.get(),
+			img.pixels.get() + img.row_bytes() * img.height);
+	levels.insert(levels.end(), mips.begin(), mips.end());
+
+	if (out_format != RAW)
+		compress(levels, img.channels, out_format == COMPRESS_BC1 ? BC1 :
+				out_format == COMPRESS_BC3 ? BC3 : BC5);
+
+	if (!write_file(output, levels, img.channels, flip, out_format)) {
+		std::cout << "Failed to write " << output << std::endl;
+		return 1;
+	}
+	std::cout << files[0] << " -> " << output << ": " << img.width << "x"
+		<< img.height << ", " << levels.size() << " levels" << std::endl;
+	return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * mipbench - compares the CPU mip generator (mipmap.hh) with glGenerateMipmap
+ *
+ * Usage: mipbench image [runs]
+ *
+ * Both paths start from the decoded image and end with the whole chain on
+ * the GPU (glFinish), so the CPU path includes uploading every level.
+ */
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <texture.hh>
+#include <mipmap.hh>
+#include <gl_ext.hh>
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+
+static double now_ms(void) {
+	std::chrono::duration<double, std::milli> t =
+		std::chrono::steady_clock::now().time_since_epoch();
+	return t.count();
+}
+
+// Average ms to create a texture from the image with its whole mip chain
+static double run(const Image &img, Mip_filter filter, int runs) {
+	double total = 0.0;
+	Texture2D::mip_filter = filter;
+	for (int i = 0; i < runs; i++) {
+		glFinish();
+		double start = now_ms();
+		Texture2D t(img);
+		glFinish();
+		total += now_ms() - start;
+		t.free_gpu();
+	}
+	return total / runs;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cout << "Usage: mipbench image [runs]" << std::endl;
+		return 1;
+	}
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+	Image img;
+	if (!load_image(argv[1], true, img)) {
+		std::cout << "Failed to load " << argv[1] << std::endl;
+		return 1;
+	}
+
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	GLFWwindow *window = glfwCreateWindow(64, 64, "mipbench", NULL, NULL);
+	if (window == NULL) {
+		std::cout << "Failed to create GLFW window" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return 1;
+	}
+	gl_ext_load((GLADloadproc)glfwGetProcAddress);
+
+	std::cout << glGetString(GL_RENDERER) << ", " << img.width << "x"
+		<< img.height << ", " << img.channels << " channels, "
+		<< std::thread::hardware_concurrency() << " threads, " << mip_isa()
+		<< std::endl;
+
+	// Warm up both paths
+	run(img, MIP_DRIVER, 1);
+	run(img, MIP_BOX, 1);
+
+	std::cout << "glGenerateMipmap: " << run(img, MIP_DRIVER, runs) << " ms" << std::endl;
+	std::cout << "CPU box:          " << run(img, MIP_BOX, runs) << " ms" << std::endl;
+	std::cout << "CPU kaiser:       " << run(img, MIP_KAISER, runs) << " ms" << std::endl;
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+	return 0;
+}
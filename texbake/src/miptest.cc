@@ -0,0 +1,192 @@
+/**
+ * miptest - checks the CPU mip generator (mipmap.hh): edge case sizes, linear
+ * light averaging of sRGB colors, normal renormalization and threading
+ *
+ * Usage: miptest
+ *
+ * Prints each failure and exits with 1 if there was any. Build with
+ * `make check SANITIZE=1` to also catch reads past the rows.
+ */
+#include <mipmap.hh>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+static int failures = 0;
+
+static void fail(const std::string &what) {
+	std::cout << "FAIL: " << what << std::endl;
+	failures++;
+}
+
+/*
+ * A gray ramp from 40 to 200 along the long side, the same in every
+ * channel: every level has to keep the channels equal, and with a box
+ * filter stay within the ramp and, for a power of two length, end on its
+ * mean (120) within rounding.
+ */
+static void check_strip(int width, int height, int channels, Mip_filter filter) {
+	std::string name = std::to_string(width) + "x" + std::to_string(height)
+		+ ", " + std::to_string(channels) + " channels, "
+		+ (filter == MIP_BOX ? "box" : "kaiser");
+	int n = width * height;
+	std::vector<unsigned char> pixels(n * channels);
+	for (int i = 0; i < n; i++)
+		for (int c = 0; c < channels; c++)
+			pixels[i * channels + c] = n > 1 ? 40 + i * 160 / (n - 1) : 120;
+
+	std::vector<Mip_level> levels;
+	mip_generate(pixels.data(), width, height, channels, levels, filter,
+			TEXTURE_MASK, 1);
+
+	int w = width, h = height;
+	for (unsigned int l = 0; l < levels.size(); l++) {
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		const Mip_level &level = levels[l];
+		std::string at = name + ", level " + std::to_string(l + 1);
+		if (level.width != w || level.height != h) {
+			fail(at + ": " + std::to_string(level.width) + "x"
+					+ std::to_string(level.height));
+			return;
+		}
+		if (level.pixels.size() != (size_t)w * h * channels) {
+			fail(at + ": " + std::to_string(level.pixels.size()) + " bytes");
+			return;
+		}
+		for (int i = 0; i < w * h; i++) {
+			int v = level.pixels[i * channels];
+			if (filter == MIP_BOX && (v < 40 || v > 200))
+				fail(at + ": " + std::to_string(v) + " at "
+						+ std::to_string(i));
+			for (int c = 1; c < channels; c++)
+				if (level.pixels[i * channels + c] != v)
+					fail(at + ": channels differ at " + std::to_string(i));
+		}
+	}
+	if (w != 1 || h != 1)
+		fail(name + ": chain stops at " + std::to_string(w) + "x"
+				+ std::to_string(h));
+	if (filter == MIP_BOX && n > 1 && (n & (n - 1)) == 0) {
+		int last = levels.back().pixels[0];
+		if (abs(last - 120) > 2)
+			fail(name + ": 1x1 level is " + std::to_string(last));
+	}
+}
+
+/*
+ * Black and white averaged in linear light: 0.5, which is 188 in sRGB
+ * (128 would be averaging the encoded values). Alpha stays linear.
+ */
+static void check_srgb(int channels, Texture_usage usage) {
+	std::string name = "sRGB pair, " + std::to_string(channels) + " channels"
+		+ (usage == TEXTURE_COLOR ? "" : ", TEXTURE_COLOR_SRGB");
+	std::vector<unsigned char> pixels(2 * channels, 0);
+	for (int c = 0; c < channels; c++)
+		pixels[channels + c] = 255;
+	std::vector<Mip_level> levels;
+	mip_generate(pixels.data(), 2, 1, channels, levels, MIP_BOX, usage, 1);
+	if (levels.size() != 1) {
+		fail(name + ": " + std::to_string(levels.size()) + " levels");
+		return;
+	}
+	for (int c = 0; c < channels; c++) {
+		bool alpha = channels == 2 ? c == 1 : c == 3;
+		int v = levels[0].pixels[c], expected = alpha ? 128 : 188;
+		if (abs(v - expected) > 1)
+			fail(name + ": channel " + std::to_string(c) + " is "
+					+ std::to_string(v) + ", expected "
+					+ std::to_string(expected));
+	}
+}
+
+/*
+ * Normals turned by 90 degrees from texel to texel: their averages are
+ * shorter than 1, every level has to be renormalized.
+ */
+static void check_normals(int channels, Mip_filter filter) {
+	std::string name = "normals, " + std::to_string(channels) + " channels, "
+		+ (filter == MIP_BOX ? "box" : "kaiser");
+	const unsigned char dirs[4][3] = {{255, 128, 128}, {128, 255, 128},
+		{128, 128, 255}, {0, 128, 128}};
+	int size = 16;
+	std::vector<unsigned char> pixels(size * size * channels, 255);
+	for (int i = 0; i < size * size; i++)
+		for (int c = 0; c < 3; c++)
+			pixels[i * channels + c] = dirs[(i + i / size) % 4][c];
+	std::vector<Mip_level> levels;
+	mip_generate(pixels.data(), size, size, channels, levels, filter,
+			TEXTURE_NORMAL, 1);
+	for (unsigned int l = 0; l < levels.size(); l++) {
+		const Mip_level &level = levels[l];
+		for (int i = 0; i < level.width * level.height; i++) {
+			float len = 0.0f;
+			for (int c = 0; c < 3; c++) {
+				float v = level.pixels[i * channels + c] / 255.0f * 2.0f - 1.0f;
+				len += v * v;
+			}
+			len = sqrtf(len);
+			// 8 bit components, a few hundredths either way
+			if (fabsf(len - 1.0f) > 0.03f) {
+				fail(name + ", level " + std::to_string(l + 1) + ": length "
+						+ std::to_string(len) + " at " + std::to_string(i));
+				return;
+			}
+		}
+	}
+}
+
+// Rows split over threads give the same bytes as a single thread
+static void check_threads(Mip_filter filter, Texture_usage usage) {
+	std::string name = std::string("threads, ")
+		+ (filter == MIP_BOX ? "box" : "kaiser") + ", usage "
+		+ std::to_string(usage);
+	int width = 200, height = 300, channels = 4;
+	std::vector<unsigned char> pixels(width * height * channels);
+	srand(1);
+	for (unsigned int i = 0; i < pixels.size(); i++)
+		pixels[i] = rand() & 255;
+	std::vector<Mip_level> single, split;
+	mip_generate(pixels.data(), width, height, channels, single, filter,
+			usage, 1);
+	mip_generate(pixels.data(), width, height, channels, split, filter,
+			usage, 4);
+	if (single.size() != split.size()) {
+		fail(name + ": level counts differ");
+		return;
+	}
+	for (unsigned int l = 0; l < single.size(); l++)
+		if (single[l].pixels != split[l].pixels)
+			fail(name + ": level " + std::to_string(l + 1) + " differs");
+}
+
+int main(void) {
+	std::cout << "miptest, " << mip_isa() << std::endl;
+	int sizes[] = {1, 2, 3, 5, 8, 13, 64};
+	Mip_filter filters[] = {MIP_BOX, MIP_KAISER};
+	for (int f = 0; f < 2; f++)
+		for (int channels = 1; channels <= 4; channels++)
+			for (int i = 0; i < 7; i++) {
+				check_strip(1, sizes[i], channels, filters[f]);
+				check_strip(sizes[i], 1, channels, filters[f]);
+			}
+	for (int channels = 2; channels <= 4; channels++) {
+		check_srgb(channels, TEXTURE_COLOR);
+		check_srgb(channels, TEXTURE_COLOR_SRGB);
+	}
+	Texture_usage usages[] = {TEXTURE_COLOR, TEXTURE_NORMAL, TEXTURE_MASK};
+	for (int f = 0; f < 2; f++) {
+		check_normals(3, filters[f]);
+		check_normals(4, filters[f]);
+		for (int u = 0; u < 3; u++)
+			check_threads(filters[f], usages[u]);
+	}
+	if (failures) {
+		std::cout << failures << " failures" << std::endl;
+		return 1;
+	}
+	std::cout << "all passed" << std::endl;
+	return 0;
+}